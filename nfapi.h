@@ -31,7 +31,8 @@ typedef enum _NF_STATUS
 	NF_STATUS_FAIL			= -1,
 	NF_STATUS_INVALID_ENDPOINT_ID	= -2,
 	NF_STATUS_NOT_INITIALIZED	= -3,
-	NF_STATUS_IO_ERROR		= -4
+	NF_STATUS_IO_ERROR		= -4,
+	NF_STATUS_INVALID_PARAMETER	= -5
 } NF_STATUS;
 
 // Flags for NF_UDP_OPTIONS.flags
@@ -95,6 +96,7 @@ typedef enum _NF_STATUS
 			* when NF_INDICATE_CONNECT_REQUESTS flag is specified in an appropriate rule.
 			* It is possible to change pConnInfo->filteringFlag and pConnInfo->remoteAddress
 			* in this handler. The changes will be applied to connection.
+			* nf_tcpSetEventMask can be called here to change the events of the connection.
 			* @param id Unique connection identifier
 			* @param pConnInfo Connection parameters, see <tt>NF_TCP_CONN_INFO</tt>
 			**/
@@ -116,6 +118,8 @@ typedef enum _NF_STATUS
 
 			/**
 			* Indicates the buffer received from server.
+			* buf is NULL when NF_EM_RECEIVE_METADATA_ONLY is set in the event mask,
+			* the data is already passed to local process in this case.
 			* @param id Unique connection identifier
 			* @param buf Pointer to data buffer
 			* @param len Buffer length
@@ -124,6 +128,8 @@ typedef enum _NF_STATUS
 
 			/**
 			* Indicates the buffer sent from the local socket.
+			* buf is NULL when NF_EM_SEND_METADATA_ONLY is set in the event mask,
+			* the data is already sent to remote server in this case.
 			* @param id Unique connection identifier
 			* @param buf Pointer to data buffer
 			* @param len Buffer length
@@ -163,6 +169,7 @@ typedef enum _NF_STATUS
 			* when NF_INDICATE_CONNECT_REQUESTS flag is specified in an appropriate rule.
 			* It is possible to change pConnReq->filteringFlag and pConnReq->remoteAddress
 			* in this handler. The changes will be applied to connection.
+			* nf_udpSetEventMask can be called here to change the events of the socket.
 			* @param id Unique connection identifier
 			* @param pConnInfo Connection parameters, see <tt>NF_UDP_CONN_REQUEST</tt>
 			**/
@@ -177,6 +184,7 @@ typedef enum _NF_STATUS
 
 			/**
 			* Indicates the buffer received from server.
+			* buf is NULL when NF_EM_RECEIVE_METADATA_ONLY is set in the event mask.
 			* @param id Unique socket identifier
 			* @param options UDP options
 			* @param remoteAddress Source address
@@ -187,6 +195,7 @@ typedef enum _NF_STATUS
 
 			/**
 			* Indicates the buffer sent from the local socket.
+			* buf is NULL when NF_EM_SEND_METADATA_ONLY is set in the event mask.
 			* @param id Unique socket identifier
 			* @param options UDP options
 			* @param remoteAddress Destination address
@@ -255,6 +264,27 @@ typedef enum _NF_STATUS
 
 #endif // _C_API
 
+/**
+*	Edit operation types for NF_EDIT_OP.type
+**/
+typedef enum _NF_EDIT_OP_TYPE
+{
+	NF_EDIT_KEEP = 0,	// Copy a range of the original buffer
+	NF_EDIT_INSERT = 1,	// Insert new bytes
+	NF_EDIT_DROP = 2	// Skip a range of the original buffer
+} NF_EDIT_OP_TYPE;
+
+/**
+*	Payload edit operation, see nf_tcpPostReceiveEdits and nf_tcpPostSendEdits
+**/
+typedef struct _NF_EDIT_OP
+{
+	int				type;		// See NF_EDIT_OP_TYPE
+	unsigned long	offset;		// Range offset in the original buffer, ignored for NF_EDIT_INSERT
+	unsigned long	length;		// Range length or the length of inserted bytes
+	const char *	data;		// Inserted bytes for NF_EDIT_INSERT
+} NF_EDIT_OP, *PNF_EDIT_OP;
+
 /**
 * Initializes the internal data structures and starts the filtering thread.
 * @param driverName The name of TDI hooking driver, without ".sys" extension.
@@ -314,6 +344,40 @@ nf_tcpPostSend(ENDPOINT_ID id, const char * buf, int len);
 NFAPI_API NF_STATUS NFAPI_CC 
 nf_tcpPostReceive(ENDPOINT_ID id, const char * buf, int len);
 
+/**
+* Sends the edited buffer to remote server via specified connection.
+* The output is assembled from the original buffer and inserted bytes 
+* directly in the driver IO buffers, without intermediate copies. 
+* Call it from tcpSend handler, before the indicated buffer is released.
+* NF_EDIT_KEEP and NF_EDIT_DROP ranges must cover the buffer exactly: 
+* the first range starts at offset 0, each next range starts where the 
+* previous one ends and the last one ends at len. NF_EDIT_INSERT operations
+* may be placed anywhere between them. Otherwise NF_STATUS_INVALID_PARAMETER
+* is returned and nothing is posted.
+* The output larger than NF_TCP_PACKET_BUF_SIZE is posted as several 
+* consecutive packets of at most NF_TCP_PACKET_BUF_SIZE bytes, in order.
+* @param id Connection identifier
+* @param buf Pointer to the original data buffer
+* @param len Buffer length
+* @param ops Array of edit operations applied in order
+* @param opCount Number of edit operations
+**/
+NFAPI_API NF_STATUS NFAPI_CC 
+nf_tcpPostSendEdits(ENDPOINT_ID id, const char * buf, int len, const NF_EDIT_OP * ops, int opCount);
+
+/**
+* Indicates the edited buffer to local process via specified connection.
+* See nf_tcpPostSendEdits for the rules of edit operations.
+* Call it from tcpReceive handler, before the indicated buffer is released.
+* @param id Connection identifier
+* @param buf Pointer to the original data buffer
+* @param len Buffer length
+* @param ops Array of edit operations applied in order
+* @param opCount Number of edit operations
+**/
+NFAPI_API NF_STATUS NFAPI_CC 
+nf_tcpPostReceiveEdits(ENDPOINT_ID id, const char * buf, int len, const NF_EDIT_OP * ops, int opCount);
+
 /**
 * Breaks the connection with given id.
 * @param id Connection identifier
@@ -335,6 +399,15 @@ nf_setTCPTimeout(unsigned long timeout);
 NFAPI_API NF_STATUS NFAPI_CC 
 nf_tcpDisableFiltering(ENDPOINT_ID id);
 
+/**
+ *	Changes the set of events indicated to user mode for the specified connection.
+ *	Returns NF_STATUS_FAIL if the driver version is lower than 2.
+ *  @param id Connection identifier
+ *  @param eventMask See <tt>NF_EVENT_MASK_FLAG</tt>
+ */
+NFAPI_API NF_STATUS NFAPI_CC 
+nf_tcpSetEventMask(ENDPOINT_ID id, unsigned long eventMask);
+
 
 //
 // UDP control routines
@@ -377,6 +450,15 @@ nf_udpPostReceive(ENDPOINT_ID id, const unsigned char * remoteAddress, const cha
 NFAPI_API NF_STATUS NFAPI_CC 
 nf_udpDisableFiltering(ENDPOINT_ID id);
 
+/**
+ *	Changes the set of events indicated to user mode for the specified socket.
+ *	Returns NF_STATUS_FAIL if the driver version is lower than 2.
+ *  @param id Socket identifier
+ *  @param eventMask See <tt>NF_EVENT_MASK_FLAG</tt>
+ */
+NFAPI_API NF_STATUS NFAPI_CC 
+nf_udpSetEventMask(ENDPOINT_ID id, unsigned long eventMask);
+
 
 //
 // Filtering rules 
@@ -396,12 +478,36 @@ nf_addRule(PNF_RULE pRule, int toHead);
 NFAPI_API NF_STATUS NFAPI_CC 
 nf_deleteRules();
 
+/**
+* Add a rule with event subscription mask to the rules list in driver.
+* Returns NF_STATUS_FAIL if the driver version is lower than 2.
+* @param pRule See <tt>NF_RULE_EX</tt>
+* @param toHead TRUE (1) - add rule to list head, FALSE (0) - add rule to tail
+**/
+NFAPI_API NF_STATUS NFAPI_CC 
+nf_addRuleEx(PNF_RULE_EX pRule, int toHead);
+
 /**
 *	Detaches from filtered TCP/UDP sockets
 **/
 NFAPI_API NF_STATUS NFAPI_CC
 nf_disableFiltering();
 
+/**
+*	Returns the interface version of the attached driver, see NF_DRIVER_VERSION.
+*	Drivers that do not report a version return 1.
+**/
+NFAPI_API unsigned long NFAPI_CC
+nf_getDriverVersion();
+
+/**
+*	Returns the identifier of the attached driver instance. It changes each time
+*	the driver is loaded, ENDPOINT_IDs are unique only within one instance.
+*	Drivers older than version 2 return 0.
+**/
+NFAPI_API unsigned __int64 NFAPI_CC
+nf_getDriverInstanceId();
+
 //
 // Debug routine
 //
@@ -0,0 +1,962 @@
+//
+// 	NetFilterSDK
+// 	Copyright (C) 2009 Vitaly Sidorov
+//	All rights reserved.
+//
+//	This file is a part of the NetFilter SDK.
+//	The code and information is provided "as-is" without
+//	warranty of any kind, either expressed or implied.
+//
+
+#ifndef _NF_DNS_H
+#define _NF_DNS_H
+
+#include <malloc.h>
+#include "nfhelpers.h"
+
+#ifndef _C_API
+namespace nfapi
+{
+#else
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+#endif
+
+	#define NF_DNS_PORT				53
+	#define NF_DNS_MAX_NAME_LENGTH	256
+	#define NF_DNS_SHARDS			16		// Must be a power of two
+	#define NF_DNS_MAX_PROBES		8
+	#define NF_DNS_MAX_RULE_PROBES	16
+	#define NF_DNS_MAX_CNAMES		16		// CNAME records followed in one response
+	#define NF_DNS_QUERY_TABLE_SIZE	4096
+	#define NF_DNS_QUERY_TIMEOUT	10000	// Milliseconds
+	#define NF_DNS_MIN_TTL			5		// Seconds
+	#define NF_DNS_MAX_TTL			86400	// Seconds
+
+	#define NF_DNS_TYPE_A			1
+	#define NF_DNS_TYPE_CNAME		5
+	#define NF_DNS_TYPE_AAAA		28
+	#define NF_DNS_CLASS_IN			1
+
+	/**
+	*	Called when a DNS answer adds the address of a host matching a host rule.
+	*	pRule is the rule template with remote address set to the resolved address.
+	**/
+	typedef void (NFAPI_CC *tNF_DnsRuleCallback)(PNF_RULE pRule, const char * hostName, void * context);
+
+	// Internal structures
+
+	typedef struct _NF_DNS_ENTRY
+	{
+		DWORD			expires;		// GetTickCount() value, zero for empty entries
+		unsigned short	ip_family;		// AF_INET or AF_INET6
+		unsigned char	address[NF_MAX_IP_ADDRESS_LENGTH];
+		int				hostRule;		// Index of the matching host rule or -1
+		char			name[NF_DNS_MAX_NAME_LENGTH];
+	} NF_DNS_ENTRY, *PNF_DNS_ENTRY;
+
+	typedef struct _NF_DNS_SHARD
+	{
+		SRWLOCK			lock;
+		PNF_DNS_ENTRY	pEntries;
+	} NF_DNS_SHARD, *PNF_DNS_SHARD;
+
+	typedef struct _NF_DNS_HOST_RULE
+	{
+		char			pattern[NF_DNS_MAX_NAME_LENGTH];
+		NF_RULE			rule;
+	} NF_DNS_HOST_RULE, *PNF_DNS_HOST_RULE;
+
+	// Address already expanded from a host rule
+	typedef struct _NF_DNS_RULE_ADDRESS
+	{
+		DWORD			expires;		// GetTickCount() value, zero for empty entries
+		int				hostRule;
+		unsigned short	ip_family;
+		unsigned char	address[NF_MAX_IP_ADDRESS_LENGTH];
+	} NF_DNS_RULE_ADDRESS, *PNF_DNS_RULE_ADDRESS;
+
+	// Query sent by a local socket and waiting for response
+	typedef struct _NF_DNS_QUERY
+	{
+		DWORD			expires;		// GetTickCount() value, zero for empty entries
+		ENDPOINT_ID		socket;
+		unsigned short	transactionId;
+		unsigned char	server[NF_MAX_ADDRESS_LENGTH];
+		char			name[NF_DNS_MAX_NAME_LENGTH];
+	} NF_DNS_QUERY, *PNF_DNS_QUERY;
+
+	typedef struct _NF_DNS_CACHE
+	{
+		NF_DNS_SHARD	shards[NF_DNS_SHARDS];
+		unsigned long	shardSize;
+
+		SRWLOCK			rulesLock;
+		PNF_DNS_HOST_RULE	pRules;
+		int				ruleCount;
+		int				ruleCapacity;
+		PNF_DNS_RULE_ADDRESS	pRuleAddresses;
+		unsigned long	ruleAddressCapacity;
+		tNF_DnsRuleCallback	ruleCallback;
+		void *			ruleCallbackContext;
+
+		SRWLOCK			queriesLock;
+		PNF_DNS_QUERY	pQueries;
+	} NF_DNS_CACHE, *PNF_DNS_CACHE;
+
+	/**
+	* Matches a host name with a pattern, case-insensitive.
+	* '*' in pattern matches any sequence of characters, e.g. "*.example.com".
+	* @param pattern Host name pattern
+	* @param name Lower case host name
+	**/
+	__inline BOOL nf_dnsMatchPattern(const char * pattern, const char * name)
+	{
+		const char * pStar = NULL;
+		const char * pResume = NULL;
+		char c;
+
+		while (*name)
+		{
+			c = *pattern;
+			if (c >= 'A' && c <= 'Z')
+				c += 'a' - 'A';
+
+			if (c == '*')
+			{
+				pStar = pattern++;
+				pResume = name;
+			} else
+			if (c && c == *name)
+			{
+				pattern++;
+				name++;
+			} else
+			if (pStar)
+			{
+				pattern = pStar + 1;
+				name = ++pResume;
+			} else
+			{
+				return FALSE;
+			}
+		}
+
+		while (*pattern == '*')
+			pattern++;
+
+		return *pattern == 0;
+	}
+
+	__inline int nf_dnsAddressLength(unsigned short ip_family)
+	{
+		return (ip_family == AF_INET6)? 16 : 4;
+	}
+
+	/**
+	* Returns a pointer to IP address in sockaddr_in or sockaddr_in6
+	**/
+	__inline const unsigned char * nf_dnsSockaddrIp(unsigned short ip_family, const unsigned char * sockAddress)
+	{
+		return (ip_family == AF_INET6)? sockAddress + 8 : sockAddress + 4;
+	}
+
+	__inline unsigned short nf_dnsSockaddrFamily(const unsigned char * sockAddress)
+	{
+		return (unsigned short)(sockAddress[0] | (sockAddress[1] << 8));
+	}
+
+	// sin_port and sin6_port are in network byte order at the same offset
+	__inline unsigned short nf_dnsSockaddrPort(const unsigned char * sockAddress)
+	{
+		return (unsigned short)((sockAddress[2] << 8) | sockAddress[3]);
+	}
+
+	__inline BOOL nf_dnsSameSockaddr(const unsigned char * a, const unsigned char * b)
+	{
+		unsigned short ip_family = nf_dnsSockaddrFamily(a);
+
+		return ip_family == nf_dnsSockaddrFamily(b) &&
+			nf_dnsSockaddrPort(a) == nf_dnsSockaddrPort(b) &&
+			memcmp(nf_dnsSockaddrIp(ip_family, a), nf_dnsSockaddrIp(ip_family, b),
+				nf_dnsAddressLength(ip_family)) == 0;
+	}
+
+	__inline unsigned long nf_dnsHashAddress(unsigned short ip_family, const unsigned char * address)
+	{
+		return nf_hashBytes(NF_HASH_INIT, address, nf_dnsAddressLength(ip_family));
+	}
+
+	__inline int nf_dnsFindHostRule(PNF_DNS_CACHE pCache, const char * name)
+	{
+		int i;
+
+		for (i = 0; i < pCache->ruleCount; i++)
+		{
+			if (nf_dnsMatchPattern(pCache->pRules[i].pattern, name))
+				return i;
+		}
+
+		return -1;
+	}
+
+	__inline void nf_dnsIndicateRule(PNF_DNS_CACHE pCache, PNF_RULE pRule, const char * name)
+	{
+		if (pCache->ruleCallback)
+		{
+			pCache->ruleCallback(pRule, name, pCache->ruleCallbackContext);
+		} else
+		{
+			nf_addRule(pRule, TRUE);
+		}
+	}
+
+	/**
+	* Expands the host rule for an address once. Repeated answers for the
+	* same host rule and address only extend the expiration time.
+	**/
+	__inline void nf_dnsExpandHostRule(PNF_DNS_CACHE pCache, const char * name, unsigned short ip_family, const unsigned char * address, DWORD expires)
+	{
+		int addrLen = nf_dnsAddressLength(ip_family);
+		unsigned long n = pCache->ruleAddressCapacity;
+		unsigned long hash;
+		PNF_DNS_RULE_ADDRESS pEntry, pFree = NULL;
+		BOOL isNew = FALSE;
+		NF_RULE rule;
+		int hostRule;
+		unsigned long i;
+
+		AcquireSRWLockExclusive(&pCache->rulesLock);
+
+		hostRule = nf_dnsFindHostRule(pCache, name);
+		if (hostRule < 0)
+		{
+			ReleaseSRWLockExclusive(&pCache->rulesLock);
+			return;
+		}
+
+		hash = nf_hashBytes(nf_dnsHashAddress(ip_family, address), &hostRule, sizeof(hostRule));
+
+		for (i = 0; i < NF_DNS_MAX_RULE_PROBES && i < n; i++)
+		{
+			pEntry = &pCache->pRuleAddresses[(hash + i) % n];
+
+			if (!pEntry->expires)
+			{
+				if (!pFree)
+					pFree = pEntry;
+				break;
+			}
+
+			if (pEntry->hostRule == hostRule &&
+				pEntry->ip_family == ip_family &&
+				memcmp(pEntry->address, address, addrLen) == 0)
+			{
+				if ((LONG)(expires - pEntry->expires) > 0)
+					pEntry->expires = expires;
+				pFree = NULL;
+				break;
+			}
+		}
+
+		// Skipped when the table is full, the address is not expanded until
+		// nf_dnsCacheExpireHostRules frees space
+		if (pFree)
+		{
+			pFree->expires = expires;
+			pFree->hostRule = hostRule;
+			pFree->ip_family = ip_family;
+			memset(pFree->address, 0, sizeof(pFree->address));
+			memcpy(pFree->address, address, addrLen);
+
+			rule = pCache->pRules[hostRule].rule;
+			isNew = TRUE;
+		}
+
+		ReleaseSRWLockExclusive(&pCache->rulesLock);
+
+		if (isNew)
+		{
+			rule.ip_family = ip_family;
+			memset(rule.remoteIpAddress, 0, sizeof(rule.remoteIpAddress));
+			memcpy(rule.remoteIpAddress, address, addrLen);
+			memset(rule.remoteIpAddressMask, 0, sizeof(rule.remoteIpAddressMask));
+			memset(rule.remoteIpAddressMask, 0xff, addrLen);
+
+			nf_dnsIndicateRule(pCache, &rule, name);
+		}
+	}
+
+	/**
+	* Adds an address to the cache and expands the matching host rule
+	* @param pCache DNS cache returned by nf_dnsCacheCreate
+	* @param ip_family AF_INET or AF_INET6
+	* @param address IP address, 4 bytes for IPv4 and 16 bytes for IPv6
+	* @param name Lower case host name
+	* @param ttl Time to live in seconds
+	**/
+	__inline void nf_dnsCacheAdd(PNF_DNS_CACHE pCache, unsigned short ip_family, const unsigned char * address, const char * name, unsigned long ttl)
+	{
+		unsigned long hash = nf_dnsHashAddress(ip_family, address);
+		PNF_DNS_SHARD pShard = &pCache->shards[hash & (NF_DNS_SHARDS - 1)];
+		PNF_DNS_ENTRY pEntry, pVictim = NULL;
+		int addrLen = nf_dnsAddressLength(ip_family);
+		DWORD expires;
+		int hostRule;
+		int i;
+
+		if (ttl < NF_DNS_MIN_TTL)
+			ttl = NF_DNS_MIN_TTL;
+		if (ttl > NF_DNS_MAX_TTL)
+			ttl = NF_DNS_MAX_TTL;
+
+		expires = (GetTickCount() + ttl * 1000) | 1;
+
+		AcquireSRWLockShared(&pCache->rulesLock);
+		hostRule = nf_dnsFindHostRule(pCache, name);
+		ReleaseSRWLockShared(&pCache->rulesLock);
+
+		AcquireSRWLockExclusive(&pShard->lock);
+
+		for (i = 0; i < NF_DNS_MAX_PROBES; i++)
+		{
+			pEntry = &pShard->pEntries[((hash / NF_DNS_SHARDS) + i) % pCache->shardSize];
+
+			if (pEntry->expires &&
+				pEntry->ip_family == ip_family &&
+				memcmp(pEntry->address, address, addrLen) == 0)
+			{
+				pVictim = pEntry;
+				break;
+			}
+
+			// Prefer empty entries, then the one expiring first
+			if (!pVictim ||
+				(pVictim->expires && (!pEntry->expires || (LONG)(pEntry->expires - pVictim->expires) < 0)))
+			{
+				pVictim = pEntry;
+			}
+		}
+
+		pVictim->expires = expires;
+		pVictim->ip_family = ip_family;
+		memset(pVictim->address, 0, sizeof(pVictim->address));
+		memcpy(pVictim->address, address, addrLen);
+		pVictim->hostRule = hostRule;
+		strncpy(pVictim->name, name, NF_DNS_MAX_NAME_LENGTH - 1);
+		pVictim->name[NF_DNS_MAX_NAME_LENGTH - 1] = 0;
+
+		ReleaseSRWLockExclusive(&pShard->lock);
+
+		if (hostRule >= 0)
+		{
+			nf_dnsExpandHostRule(pCache, name, ip_family, address, expires);
+		}
+	}
+
+	/**
+	* Returns the host name for the address of a connection, e.g.
+	* pConnInfo->remoteAddress in tcpConnectRequest handler.
+	* @param pCache DNS cache returned by nf_dnsCacheCreate
+	* @param ip_family AF_INET or AF_INET6
+	* @param sockAddress Address as sockaddr_in for IPv4 and sockaddr_in6 for IPv6
+	* @param name Buffer for host name
+	* @param len Buffer length
+	* @param pRule Receives the matching host rule if not NULL
+	* @return 0 if the address is not cached, 1 if it is cached without matching
+	*	host rule, 2 if it is cached and pRule is filled
+	**/
+	__inline int nf_dnsCacheLookup(PNF_DNS_CACHE pCache, unsigned short ip_family, const unsigned char * sockAddress, char * name, int len, PNF_RULE pRule)
+	{
+		const unsigned char * address = nf_dnsSockaddrIp(ip_family, sockAddress);
+		unsigned long hash = nf_dnsHashAddress(ip_family, address);
+		PNF_DNS_SHARD pShard = &pCache->shards[hash & (NF_DNS_SHARDS - 1)];
+		PNF_DNS_ENTRY pEntry;
+		int addrLen = nf_dnsAddressLength(ip_family);
+		DWORD now = GetTickCount();
+		int hostRule = -1;
+		int res = 0;
+		int i;
+
+		AcquireSRWLockShared(&pShard->lock);
+
+		for (i = 0; i < NF_DNS_MAX_PROBES; i++)
+		{
+			pEntry = &pShard->pEntries[((hash / NF_DNS_SHARDS) + i) % pCache->shardSize];
+
+			if (pEntry->expires &&
+				pEntry->ip_family == ip_family &&
+				memcmp(pEntry->address, address, addrLen) == 0)
+			{
+				if ((LONG)(pEntry->expires - now) > 0)
+				{
+					if (name && len > 0)
+					{
+						strncpy(name, pEntry->name, len - 1);
+						name[len - 1] = 0;
+					}
+					hostRule = pEntry->hostRule;
+					res = 1;
+				}
+				break;
+			}
+		}
+
+		ReleaseSRWLockShared(&pShard->lock);
+
+		if (hostRule >= 0 && pRule)
+		{
+			AcquireSRWLockShared(&pCache->rulesLock);
+			if (hostRule < pCache->ruleCount)
+			{
+				*pRule = pCache->pRules[hostRule].rule;
+				res = 2;
+			}
+			ReleaseSRWLockShared(&pCache->rulesLock);
+		}
+
+		return res;
+	}
+
+	/**
+	* Adds a rule applied to the addresses of hosts matching the pattern.
+	* The addresses already in cache are not affected.
+	* @param pCache DNS cache returned by nf_dnsCacheCreate
+	* @param pattern Host name or wildcard, e.g. "*.example.com"
+	* @param pRule Rule template, remote address fields are replaced with resolved addresses
+	**/
+	__inline BOOL nf_dnsCacheAddHostRule(PNF_DNS_CACHE pCache, const char * pattern, PNF_RULE pRule)
+	{
+		PNF_DNS_HOST_RULE pRules;
+		BOOL res = FALSE;
+
+		AcquireSRWLockExclusive(&pCache->rulesLock);
+
+		if (pCache->ruleCount == pCache->ruleCapacity)
+		{
+			pRules = (PNF_DNS_HOST_RULE)realloc(pCache->pRules,
+				(pCache->ruleCapacity * 2 + 16) * sizeof(NF_DNS_HOST_RULE));
+			if (pRules)
+			{
+				pCache->pRules = pRules;
+				pCache->ruleCapacity = pCache->ruleCapacity * 2 + 16;
+			}
+		}
+
+		if (pCache->ruleCount < pCache->ruleCapacity)
+		{
+			strncpy(pCache->pRules[pCache->ruleCount].pattern, pattern, NF_DNS_MAX_NAME_LENGTH - 1);
+			pCache->pRules[pCache->ruleCount].pattern[NF_DNS_MAX_NAME_LENGTH - 1] = 0;
+			pCache->pRules[pCache->ruleCount].rule = *pRule;
+			pCache->ruleCount++;
+			res = TRUE;
+		}
+
+		ReleaseSRWLockExclusive(&pCache->rulesLock);
+
+		return res;
+	}
+
+	/**
+	* Sets a function called for new addresses of hosts matching host rules.
+	* By default such rules are added to the list head with nf_addRule.
+	* @param pCache DNS cache returned by nf_dnsCacheCreate
+	* @param callback Callback or NULL for default behavior
+	* @param context Parameter for callback
+	**/
+	__inline void nf_dnsCacheSetRuleCallback(PNF_DNS_CACHE pCache, tNF_DnsRuleCallback callback, void * context)
+	{
+		AcquireSRWLockExclusive(&pCache->rulesLock);
+		pCache->ruleCallback = callback;
+		pCache->ruleCallbackContext = context;
+		ReleaseSRWLockExclusive(&pCache->rulesLock);
+	}
+
+	/**
+	* Forgets the expanded addresses whose TTL ran out. The driver has no way
+	* to remove single rules, so when this function returns non-zero value
+	* the caller rebuilds the driver rules: nf_deleteRules, the own rules and
+	* nf_dnsCacheApplyHostRules for the addresses that are still valid.
+	* @param pCache DNS cache returned by nf_dnsCacheCreate
+	* @return Number of expired addresses
+	**/
+	__inline unsigned long nf_dnsCacheExpireHostRules(PNF_DNS_CACHE pCache)
+	{
+		unsigned long n = pCache->ruleAddressCapacity;
+		PNF_DNS_RULE_ADDRESS pRuleAddresses;
+		DWORD now = GetTickCount();
+		unsigned long i, res = 0;
+
+		AcquireSRWLockExclusive(&pCache->rulesLock);
+
+		for (i = 0; i < n; i++)
+		{
+			if (pCache->pRuleAddresses[i].expires &&
+				(LONG)(pCache->pRuleAddresses[i].expires - now) <= 0)
+			{
+				pCache->pRuleAddresses[i].expires = 0;
+				res++;
+			}
+		}
+
+		// Reinsert the rest to keep probe sequences without holes
+		pRuleAddresses = res? (PNF_DNS_RULE_ADDRESS)malloc(n * sizeof(NF_DNS_RULE_ADDRESS)) : NULL;
+		if (pRuleAddresses)
+		{
+			memcpy(pRuleAddresses, pCache->pRuleAddresses, n * sizeof(NF_DNS_RULE_ADDRESS));
+			memset(pCache->pRuleAddresses, 0, n * sizeof(NF_DNS_RULE_ADDRESS));
+
+			for (i = 0; i < n; i++)
+			{
+				PNF_DNS_RULE_ADDRESS pEntry = &pRuleAddresses[i];
+				unsigned long hash, j;
+
+				if (!pEntry->expires)
+					continue;
+
+				hash = nf_hashBytes(nf_dnsHashAddress(pEntry->ip_family, pEntry->address),
+					&pEntry->hostRule, sizeof(pEntry->hostRule));
+
+				for (j = 0; j < NF_DNS_MAX_RULE_PROBES && j < n; j++)
+				{
+					if (!pCache->pRuleAddresses[(hash + j) % n].expires)
+					{
+						pCache->pRuleAddresses[(hash + j) % n] = *pEntry;
+						break;
+					}
+				}
+			}
+		}
+
+		ReleaseSRWLockExclusive(&pCache->rulesLock);
+
+		if (pRuleAddresses)
+			free(pRuleAddresses);
+
+		return res;
+	}
+
+	/**
+	* Indicates the rules for all unexpired expanded addresses again,
+	* via the rule callback or nf_addRule. The host rule pattern is passed
+	* to the callback as host name.
+	* @param pCache DNS cache returned by nf_dnsCacheCreate
+	**/
+	__inline void nf_dnsCacheApplyHostRules(PNF_DNS_CACHE pCache)
+	{
+		unsigned long n = pCache->ruleAddressCapacity;
+		PNF_DNS_RULE_ADDRESS pEntry;
+		PNF_RULE pRules;
+		char (* pNames)[NF_DNS_MAX_NAME_LENGTH];
+		DWORD now = GetTickCount();
+		unsigned long i, count = 0;
+		int addrLen;
+
+		pRules = (PNF_RULE)malloc(n * sizeof(NF_RULE));
+		pNames = (char (*)[NF_DNS_MAX_NAME_LENGTH])malloc(n * NF_DNS_MAX_NAME_LENGTH);
+		if (!pRules || !pNames)
+		{
+			free(pRules);
+			free(pNames);
+			return;
+		}
+
+		// The callback is called without holding the lock, so the patterns are copied,
+		// nf_dnsCacheAddHostRule may reallocate the host rule array meanwhile
+		AcquireSRWLockShared(&pCache->rulesLock);
+
+		for (i = 0; i < n; i++)
+		{
+			pEntry = &pCache->pRuleAddresses[i];
+
+			if (!pEntry->expires || (LONG)(pEntry->expires - now) <= 0)
+				continue;
+
+			addrLen = nf_dnsAddressLength(pEntry->ip_family);
+			pRules[count] = pCache->pRules[pEntry->hostRule].rule;
+			pRules[count].ip_family = pEntry->ip_family;
+			memset(pRules[count].remoteIpAddress, 0, sizeof(pRules[count].remoteIpAddress));
+			memcpy(pRules[count].remoteIpAddress, pEntry->address, addrLen);
+			memset(pRules[count].remoteIpAddressMask, 0, sizeof(pRules[count].remoteIpAddressMask));
+			memset(pRules[count].remoteIpAddressMask, 0xff, addrLen);
+			memcpy(pNames[count], pCache->pRules[pEntry->hostRule].pattern, NF_DNS_MAX_NAME_LENGTH);
+			count++;
+		}
+
+		ReleaseSRWLockShared(&pCache->rulesLock);
+
+		for (i = 0; i < count; i++)
+		{
+			nf_dnsIndicateRule(pCache, &pRules[i], pNames[i]);
+		}
+
+		free(pRules);
+		free(pNames);
+	}
+
+	/**
+	* Reads a possibly compressed name from DNS message
+	* @return Position after the name in original message or -1 on error
+	**/
+	__inline int nf_dnsReadName(const unsigned char * msg, int msgLen, int pos, char * name)
+	{
+		int next = -1;
+		int nameLen = 0;
+		int jumps = 0;
+		int labelLen, i;
+		char c;
+
+		for (;;)
+		{
+			if (pos >= msgLen)
+				return -1;
+
+			labelLen = msg[pos];
+
+			if ((labelLen & 0xc0) == 0xc0)
+			{
+				if (pos + 1 >= msgLen || ++jumps > 64)
+					return -1;
+				if (next < 0)
+					next = pos + 2;
+				pos = ((labelLen & 0x3f) << 8) | msg[pos + 1];
+				continue;
+			}
+
+			if (labelLen & 0xc0)
+				return -1;
+
+			pos++;
+
+			if (labelLen == 0)
+				break;
+
+			if (pos + labelLen > msgLen || nameLen + labelLen + 1 >= NF_DNS_MAX_NAME_LENGTH)
+				return -1;
+
+			if (nameLen)
+				name[nameLen++] = '.';
+
+			for (i = 0; i < labelLen; i++)
+			{
+				c = (char)msg[pos + i];
+				if (c >= 'A' && c <= 'Z')
+					c += 'a' - 'A';
+				name[nameLen++] = c;
+			}
+
+			pos += labelLen;
+		}
+
+		name[nameLen] = 0;
+
+		return (next < 0)? pos : next;
+	}
+
+	/**
+	* Parses DNS response to a query for qname and adds A and AAAA answers
+	* to cache. A record is accepted only if its owner is qname or a name
+	* reached from qname through CNAME records of the same response.
+	* All addresses are associated with qname.
+	* @param pCache DNS cache returned by nf_dnsCacheCreate
+	* @param buf DNS message
+	* @param len Message length
+	* @param qname Lower case name of the query sent by application
+	* @return Number of cached addresses or -1 if the message is malformed
+	**/
+	__inline int nf_dnsParseResponse(PNF_DNS_CACHE pCache, const char * buf, int len, const char * qname)
+	{
+		const unsigned char * msg = (const unsigned char *)buf;
+		char name[NF_DNS_MAX_NAME_LENGTH];
+		char aliases[NF_DNS_MAX_CNAMES + 1][NF_DNS_MAX_NAME_LENGTH];
+		int firstAnswer;
+		int aliasCount = 1;
+		int qdCount, anCount;
+		int type, rclass, rdLength;
+		unsigned long ttl;
+		int pos, i, j, pass, res = 0;
+		BOOL found;
+
+		if (len < 12)
+			return -1;
+
+		// Responses with no error only
+		if (!(msg[2] & 0x80) || (msg[3] & 0x0f))
+			return 0;
+
+		qdCount = (msg[4] << 8) | msg[5];
+		anCount = (msg[6] << 8) | msg[7];
+
+		if (qdCount != 1 || anCount == 0)
+			return 0;
+
+		pos = nf_dnsReadName(msg, len, 12, name);
+		if (pos < 0 || pos + 4 > len)
+			return -1;
+		pos += 4;
+
+		if (strcmp(name, qname) != 0)
+			return 0;
+
+		strcpy(aliases[0], qname);
+		firstAnswer = pos;
+
+		// The first pass follows CNAME chain, the second one caches addresses
+		for (pass = 0; pass < 2; pass++)
+		{
+			pos = firstAnswer;
+
+			for (i = 0; i < anCount; i++)
+			{
+				pos = nf_dnsReadName(msg, len, pos, name);
+				if (pos < 0 || pos + 10 > len)
+					return -1;
+
+				type = (msg[pos] << 8) | msg[pos + 1];
+				rclass = (msg[pos + 2] << 8) | msg[pos + 3];
+				ttl = ((unsigned long)msg[pos + 4] << 24) | ((unsigned long)msg[pos + 5] << 16) |
+						((unsigned long)msg[pos + 6] << 8) | msg[pos + 7];
+				rdLength = (msg[pos + 8] << 8) | msg[pos + 9];
+				pos += 10;
+
+				if (pos + rdLength > len)
+					return -1;
+
+				found = FALSE;
+				for (j = 0; j < aliasCount && !found; j++)
+				{
+					found = strcmp(aliases[j], name) == 0;
+				}
+
+				if (found && rclass == NF_DNS_CLASS_IN)
+				{
+					if (pass == 0)
+					{
+						if (type == NF_DNS_TYPE_CNAME && aliasCount <= NF_DNS_MAX_CNAMES &&
+							nf_dnsReadName(msg, len, pos, aliases[aliasCount]) >= 0)
+						{
+							found = FALSE;
+							for (j = 0; j < aliasCount && !found; j++)
+							{
+								found = strcmp(aliases[j], aliases[aliasCount]) == 0;
+							}
+
+							// Aliases may be listed in any order, restart the pass
+							if (!found && ++aliasCount <= NF_DNS_MAX_CNAMES)
+							{
+								pos = firstAnswer;
+								i = -1;
+								continue;
+							}
+						}
+					} else
+					if (type == NF_DNS_TYPE_A && rdLength == 4)
+					{
+						nf_dnsCacheAdd(pCache, AF_INET, msg + pos, qname, ttl);
+						res++;
+					} else
+					if (type == NF_DNS_TYPE_AAAA && rdLength == 16)
+					{
+						nf_dnsCacheAdd(pCache, AF_INET6, msg + pos, qname, ttl);
+						res++;
+					}
+				}
+
+				pos += rdLength;
+			}
+		}
+
+		return res;
+	}
+
+	/**
+	* Remembers a DNS query sent to server port. Call it from udpSend handler.
+	* Only the responses to remembered queries are used by nf_dnsCacheOnUdpReceive.
+	* @param pCache DNS cache returned by nf_dnsCacheCreate
+	* @param id Socket identifier
+	* @param remoteAddress Destination address
+	* @param buf Pointer to data buffer
+	* @param len Buffer length
+	**/
+	__inline void nf_dnsCacheOnUdpSend(PNF_DNS_CACHE pCache, ENDPOINT_ID id, const unsigned char * remoteAddress, const char * buf, int len)
+	{
+		const unsigned char * msg = (const unsigned char *)buf;
+		char qname[NF_DNS_MAX_NAME_LENGTH];
+		unsigned short transactionId;
+		PNF_DNS_QUERY pEntry, pVictim = NULL;
+		unsigned long hash;
+		DWORD now = GetTickCount();
+		int i;
+
+		if (!buf || len < 12 || nf_dnsSockaddrPort(remoteAddress) != NF_DNS_PORT)
+			return;
+
+		// Standard queries with a single question only
+		if ((msg[2] & 0xf8) || ((msg[4] << 8) | msg[5]) != 1)
+			return;
+
+		if (nf_dnsReadName(msg, len, 12, qname) < 0)
+			return;
+
+		transactionId = (unsigned short)((msg[0] << 8) | msg[1]);
+		hash = nf_hashBytes(nf_hashBytes(NF_HASH_INIT, &id, sizeof(id)), &transactionId, sizeof(transactionId));
+
+		AcquireSRWLockExclusive(&pCache->queriesLock);
+
+		for (i = 0; i < NF_DNS_MAX_PROBES; i++)
+		{
+			pEntry = &pCache->pQueries[(hash + i) % NF_DNS_QUERY_TABLE_SIZE];
+
+			if (!pEntry->expires || (LONG)(pEntry->expires - now) <= 0)
+			{
+				pVictim = pEntry;
+				break;
+			}
+
+			if (!pVictim || (LONG)(pEntry->expires - pVictim->expires) < 0)
+				pVictim = pEntry;
+		}
+
+		pVictim->expires = (now + NF_DNS_QUERY_TIMEOUT) | 1;
+		pVictim->socket = id;
+		pVictim->transactionId = transactionId;
+		memcpy(pVictim->server, remoteAddress, NF_MAX_ADDRESS_LENGTH);
+		strcpy(pVictim->name, qname);
+
+		ReleaseSRWLockExclusive(&pCache->queriesLock);
+	}
+
+	/**
+	* Parses the datagram if it is a response to a query remembered by
+	* nf_dnsCacheOnUdpSend for the same socket, transaction id and server.
+	* Call it from udpReceive handler.
+	* @param pCache DNS cache returned by nf_dnsCacheCreate
+	* @param id Socket identifier
+	* @param remoteAddress Source address
+	* @param buf Pointer to data buffer
+	* @param len Buffer length
+	**/
+	__inline void nf_dnsCacheOnUdpReceive(PNF_DNS_CACHE pCache, ENDPOINT_ID id, const unsigned char * remoteAddress, const char * buf, int len)
+	{
+		const unsigned char * msg = (const unsigned char *)buf;
+		char qname[NF_DNS_MAX_NAME_LENGTH];
+		unsigned short transactionId;
+		PNF_DNS_QUERY pEntry;
+		unsigned long hash;
+		DWORD now = GetTickCount();
+		BOOL found = FALSE;
+		int i;
+
+		if (!buf || len < 12 || nf_dnsSockaddrPort(remoteAddress) != NF_DNS_PORT)
+			return;
+
+		transactionId = (unsigned short)((msg[0] << 8) | msg[1]);
+		hash = nf_hashBytes(nf_hashBytes(NF_HASH_INIT, &id, sizeof(id)), &transactionId, sizeof(transactionId));
+
+		AcquireSRWLockExclusive(&pCache->queriesLock);
+
+		for (i = 0; i < NF_DNS_MAX_PROBES; i++)
+		{
+			pEntry = &pCache->pQueries[(hash + i) % NF_DNS_QUERY_TABLE_SIZE];
+
+			if (pEntry->expires && (LONG)(pEntry->expires - now) > 0 &&
+				pEntry->socket == id &&
+				pEntry->transactionId == transactionId &&
+				nf_dnsSameSockaddr(pEntry->server, remoteAddress))
+			{
+				// A query is answered once
+				strcpy(qname, pEntry->name);
+				pEntry->expires = 0;
+				found = TRUE;
+				break;
+			}
+		}
+
+		ReleaseSRWLockExclusive(&pCache->queriesLock);
+
+		if (found)
+		{
+			nf_dnsParseResponse(pCache, buf, len, qname);
+		}
+	}
+
+	/**
+	* Releases the DNS cache
+	* @param pCache DNS cache returned by nf_dnsCacheCreate
+	**/
+	__inline void nf_dnsCacheFree(PNF_DNS_CACHE pCache)
+	{
+		int i;
+
+		if (!pCache)
+			return;
+
+		for (i = 0; i < NF_DNS_SHARDS; i++)
+		{
+			if (pCache->shards[i].pEntries)
+				free(pCache->shards[i].pEntries);
+		}
+
+		if (pCache->pRules)
+			free(pCache->pRules);
+		if (pCache->pRuleAddresses)
+			free(pCache->pRuleAddresses);
+		if (pCache->pQueries)
+			free(pCache->pQueries);
+
+		free(pCache);
+	}
+
+	/**
+	* Creates a DNS cache mapping IP addresses to host names
+	* @param maxEntries Cache capacity, also the number of addresses
+	*	expanded from host rules
+	* @return DNS cache or NULL on error
+	**/
+	__inline PNF_DNS_CACHE nf_dnsCacheCreate(unsigned long maxEntries)
+	{
+		PNF_DNS_CACHE pCache;
+		int i;
+
+		pCache = (PNF_DNS_CACHE)calloc(1, sizeof(NF_DNS_CACHE));
+		if (!pCache)
+			return NULL;
+
+		pCache->shardSize = maxEntries / NF_DNS_SHARDS;
+		if (pCache->shardSize < NF_DNS_MAX_PROBES)
+			pCache->shardSize = NF_DNS_MAX_PROBES;
+
+		pCache->ruleAddressCapacity = pCache->shardSize * NF_DNS_SHARDS;
+
+		InitializeSRWLock(&pCache->rulesLock);
+		InitializeSRWLock(&pCache->queriesLock);
+
+		for (i = 0; i < NF_DNS_SHARDS; i++)
+		{
+			InitializeSRWLock(&pCache->shards[i].lock);
+			pCache->shards[i].pEntries = (PNF_DNS_ENTRY)calloc(pCache->shardSize, sizeof(NF_DNS_ENTRY));
+			if (!pCache->shards[i].pEntries)
+			{
+				nf_dnsCacheFree(pCache);
+				return NULL;
+			}
+		}
+
+		pCache->pRuleAddresses = (PNF_DNS_RULE_ADDRESS)calloc(pCache->ruleAddressCapacity, sizeof(NF_DNS_RULE_ADDRESS));
+		pCache->pQueries = (PNF_DNS_QUERY)calloc(NF_DNS_QUERY_TABLE_SIZE, sizeof(NF_DNS_QUERY));
+		if (!pCache->pRuleAddresses || !pCache->pQueries)
+		{
+			nf_dnsCacheFree(pCache);
+			return NULL;
+		}
+
+		return pCache;
+	}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -12,6 +12,13 @@
 #ifndef _NFDRIVER_H
 #define _NFDRIVER_H
 
+/**
+*	Driver interface version. Drivers older than version 2 do not report it
+*	and do not support NF_RULE_EX, event masks and nf_getDriverInstanceId,
+*	see nf_getDriverVersion.
+**/
+#define NF_DRIVER_VERSION	2
+
 #define NF_TCP_PACKET_BUF_SIZE 8192
 #define NF_UDP_PACKET_BUF_SIZE 2 * 65536
 
@@ -46,7 +53,14 @@ typedef enum _NF_DATA_CODE
 	NF_UDP_CONNECT_REQUEST,	// Outgoing UDP connect request
 
 	NF_TCP_DISABLE_USER_MODE_FILTERING, // Disable indicating TCP packets to user mode for a connection
-	NF_UDP_DISABLE_USER_MODE_FILTERING // Disable indicating UDP packets to user mode for a socket
+	NF_UDP_DISABLE_USER_MODE_FILTERING, // Disable indicating UDP packets to user mode for a socket
+
+	// Driver version 2 and later
+
+	NF_TCP_SET_EVENT_MASK,	// Change the event subscription mask of a TCP connection
+	NF_UDP_SET_EVENT_MASK,	// Change the event subscription mask of a UDP socket
+	NF_REQ_ADD_HEAD_RULE_EX,	// Add NF_RULE_EX to list head
+	NF_REQ_ADD_TAIL_RULE_EX	// Add NF_RULE_EX to list tail
 
 } NF_DATA_CODE;
 
@@ -67,6 +81,47 @@ typedef enum _NF_FILTERING_FLAG
 	NF_INDICATE_CONNECT_REQUESTS = 16 // Indicate outgoing connect requests to API
 } NF_FILTERING_FLAG;
 
+/**
+*	Event subscription flags for NF_RULE_EX.eventMask, nf_tcpSetEventMask and nf_udpSetEventMask.
+*	The driver does not generate the IO codes that are not present in the mask,
+*	so the filtering thread never decodes or dispatches them.
+*	When NF_EM_TCP_RECEIVE/NF_EM_TCP_SEND (NF_EM_UDP_RECEIVE/NF_EM_UDP_SEND) are
+*	cleared for an NF_FILTER endpoint, the payload in that direction is passed
+*	to destination by the driver unmodified and is never held.
+*	A mask without event bits, i.e. zero or only NF_EM_*_METADATA_ONLY bits,
+*	selects all events, with the metadata flags still applied.
+*	Requires driver version 2 or later.
+**/
+typedef enum _NF_EVENT_MASK_FLAG
+{
+	NF_EM_TCP_CONNECTED = 0x1,		// Indicate NF_TCP_CONNECTED
+	NF_EM_TCP_CLOSED = 0x2,			// Indicate NF_TCP_CLOSED
+	NF_EM_TCP_RECEIVE = 0x4,		// Indicate NF_TCP_RECEIVE (incoming payload)
+	NF_EM_TCP_SEND = 0x8,			// Indicate NF_TCP_SEND (outgoing payload)
+	NF_EM_TCP_CAN_RECEIVE = 0x10,	// Indicate NF_TCP_CAN_RECEIVE
+	NF_EM_TCP_CAN_SEND = 0x20,		// Indicate NF_TCP_CAN_SEND
+
+	NF_EM_UDP_CREATED = 0x100,		// Indicate NF_UDP_CREATED
+	NF_EM_UDP_CLOSED = 0x200,		// Indicate NF_UDP_CLOSED
+	NF_EM_UDP_RECEIVE = 0x400,		// Indicate NF_UDP_RECEIVE (incoming datagrams)
+	NF_EM_UDP_SEND = 0x800,			// Indicate NF_UDP_SEND (outgoing datagrams)
+	NF_EM_UDP_CAN_RECEIVE = 0x1000,	// Indicate NF_UDP_CAN_RECEIVE
+	NF_EM_UDP_CAN_SEND = 0x2000,	// Indicate NF_UDP_CAN_SEND
+
+	// Pass the payload to destination in driver and indicate only its length,
+	// with NULL buffer, to tcpReceive/udpReceive
+	NF_EM_RECEIVE_METADATA_ONLY = 0x10000,
+	// Pass the payload to destination in driver and indicate only its length,
+	// with NULL buffer, to tcpSend/udpSend
+	NF_EM_SEND_METADATA_ONLY = 0x20000,
+
+	NF_EM_TCP_CONNECTIONS = NF_EM_TCP_CONNECTED | NF_EM_TCP_CLOSED,
+	NF_EM_TCP_ALL = 0x3f,
+	NF_EM_UDP_SOCKETS = NF_EM_UDP_CREATED | NF_EM_UDP_CLOSED,
+	NF_EM_UDP_ALL = 0x3f00,
+	NF_EM_ALL = NF_EM_TCP_ALL | NF_EM_UDP_ALL
+} NF_EVENT_MASK_FLAG;
+
 #pragma pack(push, 1)
 
 #define NF_MAX_ADDRESS_LENGTH		28
@@ -117,6 +172,15 @@ typedef UNALIGNED struct _NF_RULE
 	unsigned long	filteringFlag;	// See NF_FILTERING_FLAG
 } NF_RULE, *PNF_RULE;
 
+/**
+*	Filtering rule with event subscription mask, requires driver version 2
+**/
+typedef UNALIGNED struct _NF_RULE_EX
+{
+	NF_RULE			rule;
+	unsigned long	eventMask;	// See NF_EVENT_MASK_FLAG
+} NF_RULE_EX, *PNF_RULE_EX;
+
 typedef unsigned __int64 ENDPOINT_ID;
 
 
@@ -0,0 +1,643 @@
+//
+// 	NetFilterSDK
+// 	Copyright (C) 2009 Vitaly Sidorov
+//	All rights reserved.
+//
+//	This file is a part of the NetFilter SDK.
+//	The code and information is provided "as-is" without
+//	warranty of any kind, either expressed or implied.
+//
+
+#ifndef _NF_FLOWLOG_H
+#define _NF_FLOWLOG_H
+
+#include <tchar.h>
+#include <malloc.h>
+#include "nfhelpers.h"
+
+#ifndef _C_API
+namespace nfapi
+{
+#else
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+#endif
+
+	#define NF_FLOWLOG_SIGNATURE	0x474c464e	// "NFLG"
+	#define NF_FLOWLOG_VERSION		1
+
+	/**
+	*	Flow log flags for NF_FLOWLOG_OPTIONS.flags
+	**/
+	typedef enum _NF_FLOWLOG_FLAG
+	{
+		NF_FLOWLOG_AGGREGATE = 1	// Merge records by process and remote network before writing
+	} NF_FLOWLOG_FLAG;
+
+	#pragma pack(push, 1)
+
+	/**
+	*	Flow record, also the on-disk record format
+	**/
+	typedef struct _NF_FLOW_RECORD
+	{
+		ENDPOINT_ID		id;				// Endpoint identifier, zero in aggregated records
+		unsigned long	processId;		// Process identifier
+		unsigned char	protocol;		// IPPROTO_TCP or IPPROTO_UDP
+		unsigned char	direction;		// See NF_DIRECTION
+		unsigned short	ip_family;		// AF_INET for IPv4 and AF_INET6 for IPv6
+
+		// Local address as sockaddr_in for IPv4 and sockaddr_in6 for IPv6
+		unsigned char	localAddress[NF_MAX_ADDRESS_LENGTH];
+
+		// Remote address as sockaddr_in for IPv4 and sockaddr_in6 for IPv6.
+		// In aggregated records the port is zero and the address is
+		// truncated to /24 for IPv4 and /64 for IPv6.
+		unsigned char	remoteAddress[NF_MAX_ADDRESS_LENGTH];
+
+		unsigned __int64	inBytes;	// Bytes received
+		unsigned __int64	outBytes;	// Bytes sent
+		unsigned __int64	startTime;	// FILETIME of the flow start
+		unsigned __int64	endTime;	// FILETIME of the flow end
+		unsigned long	flowCount;		// Number of flows merged into the record
+	} NF_FLOW_RECORD, *PNF_FLOW_RECORD;
+
+	/**
+	*	Header of each flow log file, followed by NF_FLOW_RECORD array
+	**/
+	typedef struct _NF_FLOWLOG_FILE_HEADER
+	{
+		unsigned long	signature;		// NF_FLOWLOG_SIGNATURE
+		unsigned long	version;		// NF_FLOWLOG_VERSION
+		unsigned long	recordSize;		// sizeof(NF_FLOW_RECORD)
+		unsigned long	flags;			// See NF_FLOWLOG_FLAG
+		unsigned __int64	createTime;	// FILETIME of the file creation
+	} NF_FLOWLOG_FILE_HEADER, *PNF_FLOWLOG_FILE_HEADER;
+
+	#pragma pack(pop)
+
+	/**
+	*	Flow log parameters
+	**/
+	typedef struct _NF_FLOWLOG_OPTIONS
+	{
+		unsigned long	maxPendingRecords;	// Queue capacity, appends above it are dropped
+		unsigned long	flushInterval;		// Writer wakeup interval in milliseconds
+		unsigned long	maxFileSize;		// Start a new file after this size, zero to disable
+		unsigned long	rolloverInterval;	// Start a new file after this time in milliseconds, zero to disable
+		unsigned long	flags;				// See NF_FLOWLOG_FLAG
+		unsigned long	aggregationInterval; // Write aggregated records after this time in milliseconds
+		unsigned long	aggregationTableSize; // Maximum number of aggregated records in memory
+	} NF_FLOWLOG_OPTIONS, *PNF_FLOWLOG_OPTIONS;
+
+	// Internal structures
+
+	typedef struct DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT) _NF_FLOWLOG_NODE
+	{
+		SLIST_ENTRY		entry;
+		NF_FLOW_RECORD	record;
+	} NF_FLOWLOG_NODE, *PNF_FLOWLOG_NODE;
+
+	typedef struct DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT) _NF_FLOWLOG
+	{
+		SLIST_HEADER	pending;		// Records appended by the filtering thread
+		SLIST_HEADER	freeNodes;		// Preallocated nodes
+		PNF_FLOWLOG_NODE	pNodes;
+		volatile LONG	pendingCount;
+		volatile LONG	droppedCount;
+		volatile LONG	lostCount;		// Records not written because of file errors
+		volatile LONG	stop;
+		HANDLE			hWakeEvent;
+		HANDLE			hThread;
+		NF_FLOWLOG_OPTIONS	options;
+
+		// Used only by the writer thread
+		TCHAR			pathPrefix[MAX_PATH];
+		unsigned long	fileIndex;
+		HANDLE			hFile;
+		unsigned long	fileSize;
+		DWORD			fileOpenTime;
+		PNF_FLOW_RECORD	pWriteBuffer;
+		unsigned long	writeCount;
+		PNF_FLOW_RECORD	pAggTable;
+		unsigned long	aggCount;
+		DWORD			aggStartTime;
+	} NF_FLOWLOG, *PNF_FLOWLOG;
+
+	#define NF_FLOWLOG_WRITE_BUFFER_RECORDS	256
+
+	/**
+	* Fills a flow record with TCP connection properties.
+	* startTime and endTime are set to current time, inBytes and outBytes to zero.
+	* @param pRecord Record to fill
+	* @param id Connection identifier
+	* @param pConnInfo Connection parameters, see <tt>NF_TCP_CONN_INFO</tt>
+	**/
+	__inline void nf_flowLogInitTcpRecord(PNF_FLOW_RECORD pRecord, ENDPOINT_ID id, PNF_TCP_CONN_INFO pConnInfo)
+	{
+		memset(pRecord, 0, sizeof(NF_FLOW_RECORD));
+		pRecord->id = id;
+		pRecord->processId = pConnInfo->processId;
+		pRecord->protocol = IPPROTO_TCP;
+		pRecord->direction = pConnInfo->direction;
+		pRecord->ip_family = pConnInfo->ip_family;
+		memcpy(pRecord->localAddress, pConnInfo->localAddress, NF_MAX_ADDRESS_LENGTH);
+		memcpy(pRecord->remoteAddress, pConnInfo->remoteAddress, NF_MAX_ADDRESS_LENGTH);
+		pRecord->startTime = pRecord->endTime = nf_getSystemTime();
+		pRecord->flowCount = 1;
+	}
+
+	/**
+	* Fills a flow record with UDP socket properties.
+	* startTime and endTime are set to current time, inBytes and outBytes to zero.
+	* @param pRecord Record to fill
+	* @param id Socket identifier
+	* @param pConnInfo Socket parameters, see <tt>NF_UDP_CONN_INFO</tt>
+	**/
+	__inline void nf_flowLogInitUdpRecord(PNF_FLOW_RECORD pRecord, ENDPOINT_ID id, PNF_UDP_CONN_INFO pConnInfo)
+	{
+		memset(pRecord, 0, sizeof(NF_FLOW_RECORD));
+		pRecord->id = id;
+		pRecord->processId = pConnInfo->processId;
+		pRecord->protocol = IPPROTO_UDP;
+		pRecord->ip_family = pConnInfo->ip_family;
+		memcpy(pRecord->localAddress, pConnInfo->localAddress, NF_MAX_ADDRESS_LENGTH);
+		pRecord->startTime = pRecord->endTime = nf_getSystemTime();
+		pRecord->flowCount = 1;
+	}
+
+	/**
+	* Queues a flow record for writing. The call never blocks and never
+	* allocates memory, so it is safe to use in tcpClosed/udpClosed handlers.
+	* @param pLog Flow log returned by nf_flowLogCreate
+	* @param pRecord Record to append
+	* @return FALSE if the queue is full and the record is dropped
+	**/
+	__inline BOOL nf_flowLogAppend(PNF_FLOWLOG pLog, const NF_FLOW_RECORD * pRecord)
+	{
+		PNF_FLOWLOG_NODE pNode;
+		LONG count;
+
+		pNode = (PNF_FLOWLOG_NODE)InterlockedPopEntrySList(&pLog->freeNodes);
+		if (!pNode)
+		{
+			InterlockedIncrement(&pLog->droppedCount);
+			return FALSE;
+		}
+
+		memcpy(&pNode->record, pRecord, sizeof(NF_FLOW_RECORD));
+		InterlockedPushEntrySList(&pLog->pending, &pNode->entry);
+
+		// Wake the writer when the queue is half full
+		count = InterlockedIncrement(&pLog->pendingCount);
+		if (count == (LONG)(pLog->options.maxPendingRecords / 2))
+		{
+			SetEvent(pLog->hWakeEvent);
+		}
+
+		return TRUE;
+	}
+
+	/**
+	* Returns the number of records dropped because of queue overflow
+	* @param pLog Flow log returned by nf_flowLogCreate
+	**/
+	__inline unsigned long nf_flowLogGetDroppedCount(PNF_FLOWLOG pLog)
+	{
+		return (unsigned long)pLog->droppedCount;
+	}
+
+	/**
+	* Returns the number of records lost because the log file could not be
+	* created or written. The writer tries to open a new file on each wakeup
+	* after such errors.
+	* @param pLog Flow log returned by nf_flowLogCreate
+	**/
+	__inline unsigned long nf_flowLogGetLostCount(PNF_FLOWLOG pLog)
+	{
+		return (unsigned long)pLog->lostCount;
+	}
+
+	__inline void nf_flowLogFlushWriteBuffer(PNF_FLOWLOG pLog)
+	{
+		DWORD written = 0;
+		DWORD len = pLog->writeCount * sizeof(NF_FLOW_RECORD);
+
+		if (pLog->writeCount == 0)
+			return;
+
+		if (pLog->hFile != INVALID_HANDLE_VALUE &&
+			WriteFile(pLog->hFile, pLog->pWriteBuffer, len, &written, NULL) &&
+			written == len)
+		{
+			pLog->fileSize += written;
+		} else
+		{
+			// A partial record breaks the file layout, continue in a new file
+			InterlockedExchangeAdd(&pLog->lostCount,
+				(LONG)(pLog->writeCount - written / sizeof(NF_FLOW_RECORD)));
+
+			if (pLog->hFile != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(pLog->hFile);
+				pLog->hFile = INVALID_HANDLE_VALUE;
+			}
+		}
+
+		pLog->writeCount = 0;
+	}
+
+	/**
+	* Returns the index following the highest index of existing log files,
+	* so the files of previous runs are kept
+	**/
+	__inline unsigned long nf_flowLogFindNextIndex(const TCHAR * pathPrefix)
+	{
+		TCHAR pattern[MAX_PATH + 32];
+		const TCHAR * pBaseName = pathPrefix;
+		const TCHAR * p;
+		TCHAR * pEnd;
+		WIN32_FIND_DATA fd;
+		HANDLE hFind;
+		size_t baseLen;
+		unsigned long index, nextIndex = 0;
+
+		for (p = pathPrefix; *p; p++)
+		{
+			if (*p == _T('\\') || *p == _T('/'))
+				pBaseName = p + 1;
+		}
+		baseLen = _tcslen(pBaseName);
+
+		_sntprintf(pattern, MAX_PATH + 32, _T("%s.*.nfl"), pathPrefix);
+		pattern[MAX_PATH + 31] = 0;
+
+		hFind = FindFirstFile(pattern, &fd);
+		if (hFind == INVALID_HANDLE_VALUE)
+			return 0;
+
+		do
+		{
+			if (_tcsnicmp(fd.cFileName, pBaseName, baseLen) != 0 ||
+				fd.cFileName[baseLen] != _T('.'))
+				continue;
+
+			index = _tcstoul(fd.cFileName + baseLen + 1, &pEnd, 10);
+			if (pEnd == fd.cFileName + baseLen + 1 || _tcsicmp(pEnd, _T(".nfl")) != 0)
+				continue;
+
+			if (index >= nextIndex)
+				nextIndex = index + 1;
+		} while (FindNextFile(hFind, &fd));
+
+		FindClose(hFind);
+
+		return nextIndex;
+	}
+
+	__inline BOOL nf_flowLogOpenFile(PNF_FLOWLOG pLog)
+	{
+		int attempts;
+
+		TCHAR fileName[MAX_PATH + 32];
+		NF_FLOWLOG_FILE_HEADER header;
+		DWORD written = 0;
+
+		if (pLog->hFile != INVALID_HANDLE_VALUE)
+		{
+			nf_flowLogFlushWriteBuffer(pLog);
+			if (pLog->hFile != INVALID_HANDLE_VALUE)
+				CloseHandle(pLog->hFile);
+		}
+
+		// Never overwrite existing files, skip the names taken meanwhile
+		for (attempts = 0; attempts < 16; attempts++)
+		{
+			_sntprintf(fileName, MAX_PATH + 32, _T("%s.%08lu.nfl"), pLog->pathPrefix, pLog->fileIndex++);
+			fileName[MAX_PATH + 31] = 0;
+
+			pLog->hFile = CreateFile(fileName, GENERIC_WRITE, FILE_SHARE_READ, NULL,
+								CREATE_NEW, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+			if (pLog->hFile != INVALID_HANDLE_VALUE || GetLastError() != ERROR_FILE_EXISTS)
+				break;
+		}
+
+		pLog->fileSize = 0;
+		pLog->fileOpenTime = GetTickCount();
+
+		if (pLog->hFile == INVALID_HANDLE_VALUE)
+			return FALSE;
+
+		header.signature = NF_FLOWLOG_SIGNATURE;
+		header.version = NF_FLOWLOG_VERSION;
+		header.recordSize = sizeof(NF_FLOW_RECORD);
+		header.flags = pLog->options.flags;
+		header.createTime = nf_getSystemTime();
+
+		if (!WriteFile(pLog->hFile, &header, sizeof(header), &written, NULL) ||
+			written != sizeof(header))
+		{
+			CloseHandle(pLog->hFile);
+			pLog->hFile = INVALID_HANDLE_VALUE;
+			return FALSE;
+		}
+
+		pLog->fileSize += written;
+
+		return TRUE;
+	}
+
+	__inline void nf_flowLogWriteRecord(PNF_FLOWLOG pLog, const NF_FLOW_RECORD * pRecord)
+	{
+		memcpy(&pLog->pWriteBuffer[pLog->writeCount++], pRecord, sizeof(NF_FLOW_RECORD));
+		if (pLog->writeCount == NF_FLOWLOG_WRITE_BUFFER_RECORDS)
+		{
+			nf_flowLogFlushWriteBuffer(pLog);
+		}
+	}
+
+	__inline void nf_flowLogFlushAggregates(PNF_FLOWLOG pLog)
+	{
+		unsigned long i;
+
+		for (i = 0; i < pLog->options.aggregationTableSize; i++)
+		{
+			if (pLog->pAggTable[i].flowCount)
+			{
+				nf_flowLogWriteRecord(pLog, &pLog->pAggTable[i]);
+				pLog->pAggTable[i].flowCount = 0;
+			}
+		}
+
+		pLog->aggCount = 0;
+		pLog->aggStartTime = GetTickCount();
+	}
+
+	__inline void nf_flowLogAggregate(PNF_FLOWLOG pLog, const NF_FLOW_RECORD * pRecord)
+	{
+		unsigned char remote[NF_MAX_ADDRESS_LENGTH];
+		unsigned long hash;
+		unsigned long i, n = pLog->options.aggregationTableSize;
+		PNF_FLOW_RECORD pAgg;
+
+		// Keep the address family and the remote network only
+		memset(remote, 0, sizeof(remote));
+		if (pRecord->ip_family == AF_INET)
+		{
+			memcpy(remote, pRecord->remoteAddress, 2);
+			memcpy(remote + 4, pRecord->remoteAddress + 4, 3);
+		} else
+		if (pRecord->ip_family == AF_INET6)
+		{
+			memcpy(remote, pRecord->remoteAddress, 2);
+			memcpy(remote + 8, pRecord->remoteAddress + 8, 8);
+		}
+
+		hash = nf_hashBytes(NF_HASH_INIT, &pRecord->processId, sizeof(pRecord->processId));
+		hash = nf_hashBytes(hash, &pRecord->protocol, sizeof(pRecord->protocol));
+		hash = nf_hashBytes(hash, remote, sizeof(remote));
+
+		for (i = 0; i < n; i++)
+		{
+			pAgg = &pLog->pAggTable[(hash + i) % n];
+
+			if (!pAgg->flowCount)
+			{
+				memset(pAgg, 0, sizeof(NF_FLOW_RECORD));
+				pAgg->processId = pRecord->processId;
+				pAgg->protocol = pRecord->protocol;
+				pAgg->ip_family = pRecord->ip_family;
+				memcpy(pAgg->remoteAddress, remote, sizeof(remote));
+				pAgg->startTime = pRecord->startTime;
+				pLog->aggCount++;
+				break;
+			}
+
+			if (pAgg->processId == pRecord->processId &&
+				pAgg->protocol == pRecord->protocol &&
+				memcmp(pAgg->remoteAddress, remote, sizeof(remote)) == 0)
+			{
+				break;
+			}
+		}
+
+		pAgg->direction |= pRecord->direction;
+		pAgg->inBytes += pRecord->inBytes;
+		pAgg->outBytes += pRecord->outBytes;
+		if (pRecord->startTime < pAgg->startTime)
+			pAgg->startTime = pRecord->startTime;
+		if (pRecord->endTime > pAgg->endTime)
+			pAgg->endTime = pRecord->endTime;
+		pAgg->flowCount += pRecord->flowCount;
+
+		// Keep the table sparse for short probe sequences
+		if (pLog->aggCount >= n - n / 4)
+		{
+			nf_flowLogFlushAggregates(pLog);
+		}
+	}
+
+	__inline void nf_flowLogDrain(PNF_FLOWLOG pLog)
+	{
+		PSLIST_ENTRY pList, pPrev, pNext;
+		PNF_FLOWLOG_NODE pNode;
+
+		pList = InterlockedFlushSList(&pLog->pending);
+
+		// The list is LIFO, restore the order of appends
+		pPrev = NULL;
+		while (pList)
+		{
+			pNext = pList->Next;
+			pList->Next = pPrev;
+			pPrev = pList;
+			pList = pNext;
+		}
+
+		for (pList = pPrev; pList; pList = pNext)
+		{
+			pNext = pList->Next;
+			pNode = CONTAINING_RECORD(pList, NF_FLOWLOG_NODE, entry);
+
+			if (pLog->options.flags & NF_FLOWLOG_AGGREGATE)
+			{
+				nf_flowLogAggregate(pLog, &pNode->record);
+			} else
+			{
+				nf_flowLogWriteRecord(pLog, &pNode->record);
+			}
+
+			InterlockedDecrement(&pLog->pendingCount);
+			InterlockedPushEntrySList(&pLog->freeNodes, &pNode->entry);
+		}
+	}
+
+	__inline DWORD WINAPI nf_flowLogWriterThread(LPVOID lpParameter)
+	{
+		PNF_FLOWLOG pLog = (PNF_FLOWLOG)lpParameter;
+		BOOL stop;
+
+		for (;;)
+		{
+			WaitForSingleObject(pLog->hWakeEvent, pLog->options.flushInterval);
+
+			// Read once, so the final pass drains and flushes everything appended before stop
+			stop = pLog->stop;
+
+			// Retry after failed open or write
+			if (pLog->hFile == INVALID_HANDLE_VALUE)
+			{
+				nf_flowLogOpenFile(pLog);
+			}
+
+			nf_flowLogDrain(pLog);
+
+			if ((pLog->options.flags & NF_FLOWLOG_AGGREGATE) &&
+				(stop ||
+				(GetTickCount() - pLog->aggStartTime) >= pLog->options.aggregationInterval))
+			{
+				nf_flowLogFlushAggregates(pLog);
+			}
+
+			nf_flowLogFlushWriteBuffer(pLog);
+
+			if (stop)
+				break;
+
+			if ((pLog->options.maxFileSize && pLog->fileSize >= pLog->options.maxFileSize) ||
+				(pLog->options.rolloverInterval &&
+				(GetTickCount() - pLog->fileOpenTime) >= pLog->options.rolloverInterval))
+			{
+				nf_flowLogOpenFile(pLog);
+			}
+		}
+
+		if (pLog->hFile != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(pLog->hFile);
+			pLog->hFile = INVALID_HANDLE_VALUE;
+		}
+
+		return 0;
+	}
+
+	/**
+	* Stops the writer thread, writes the queued records and releases the flow log.
+	* @param pLog Flow log returned by nf_flowLogCreate
+	**/
+	__inline void nf_flowLogFree(PNF_FLOWLOG pLog)
+	{
+		if (!pLog)
+			return;
+
+		if (pLog->hThread)
+		{
+			InterlockedExchange(&pLog->stop, 1);
+			SetEvent(pLog->hWakeEvent);
+			WaitForSingleObject(pLog->hThread, INFINITE);
+			CloseHandle(pLog->hThread);
+		}
+
+		if (pLog->hFile != INVALID_HANDLE_VALUE)
+			CloseHandle(pLog->hFile);
+
+		if (pLog->hWakeEvent)
+			CloseHandle(pLog->hWakeEvent);
+
+		if (pLog->pNodes)
+			_aligned_free(pLog->pNodes);
+		if (pLog->pWriteBuffer)
+			free(pLog->pWriteBuffer);
+		if (pLog->pAggTable)
+			free(pLog->pAggTable);
+
+		_aligned_free(pLog);
+	}
+
+	/**
+	* Creates a flow log and starts its writer thread. The records are written to
+	* files named <pathPrefix>.<index>.nfl, a new file is started according to
+	* maxFileSize and rolloverInterval options. The numbering continues after
+	* the highest index of existing files, they are never overwritten.
+	* Fails if the first file cannot be created.
+	* @param pathPrefix Path and name prefix of log files
+	* @param pOptions Flow log parameters, NULL for defaults
+	* @return Flow log handle or NULL on error
+	**/
+	__inline PNF_FLOWLOG nf_flowLogCreate(const TCHAR * pathPrefix, const NF_FLOWLOG_OPTIONS * pOptions)
+	{
+		PNF_FLOWLOG pLog;
+		unsigned long i;
+		DWORD threadId;
+
+		pLog = (PNF_FLOWLOG)_aligned_malloc(sizeof(NF_FLOWLOG), MEMORY_ALLOCATION_ALIGNMENT);
+		if (!pLog)
+			return NULL;
+
+		memset(pLog, 0, sizeof(NF_FLOWLOG));
+		InitializeSListHead(&pLog->pending);
+		InitializeSListHead(&pLog->freeNodes);
+		pLog->hFile = INVALID_HANDLE_VALUE;
+
+		if (pOptions)
+		{
+			pLog->options = *pOptions;
+		}
+		if (!pLog->options.maxPendingRecords)
+			pLog->options.maxPendingRecords = 65536;
+		if (!pLog->options.flushInterval)
+			pLog->options.flushInterval = 1000;
+		if (!pLog->options.aggregationInterval)
+			pLog->options.aggregationInterval = 60000;
+		if (pLog->options.aggregationTableSize < 16)
+			pLog->options.aggregationTableSize = 16384;
+
+		_tcsncpy(pLog->pathPrefix, pathPrefix, MAX_PATH - 1);
+		pLog->fileIndex = nf_flowLogFindNextIndex(pLog->pathPrefix);
+
+		pLog->pNodes = (PNF_FLOWLOG_NODE)_aligned_malloc(
+			pLog->options.maxPendingRecords * sizeof(NF_FLOWLOG_NODE), MEMORY_ALLOCATION_ALIGNMENT);
+		pLog->pWriteBuffer = (PNF_FLOW_RECORD)malloc(NF_FLOWLOG_WRITE_BUFFER_RECORDS * sizeof(NF_FLOW_RECORD));
+		if (pLog->options.flags & NF_FLOWLOG_AGGREGATE)
+		{
+			pLog->pAggTable = (PNF_FLOW_RECORD)calloc(pLog->options.aggregationTableSize, sizeof(NF_FLOW_RECORD));
+		}
+		pLog->hWakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+		if (!pLog->pNodes || !pLog->pWriteBuffer || !pLog->hWakeEvent ||
+			((pLog->options.flags & NF_FLOWLOG_AGGREGATE) && !pLog->pAggTable))
+		{
+			nf_flowLogFree(pLog);
+			return NULL;
+		}
+
+		for (i = 0; i < pLog->options.maxPendingRecords; i++)
+		{
+			InterlockedPushEntrySList(&pLog->freeNodes, &pLog->pNodes[i].entry);
+		}
+
+		pLog->aggStartTime = GetTickCount();
+
+		if (!nf_flowLogOpenFile(pLog))
+		{
+			nf_flowLogFree(pLog);
+			return NULL;
+		}
+
+		pLog->hThread = CreateThread(NULL, 0, nf_flowLogWriterThread, pLog, 0, &threadId);
+		if (!pLog->hThread)
+		{
+			nf_flowLogFree(pLog);
+			return NULL;
+		}
+
+		return pLog;
+	}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
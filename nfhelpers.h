@@ -0,0 +1,63 @@
+//
+// 	NetFilterSDK 
+// 	Copyright (C) 2009 Vitaly Sidorov
+//	All rights reserved.
+//
+//	This file is a part of the NetFilter SDK.
+//	The code and information is provided "as-is" without
+//	warranty of any kind, either expressed or implied.
+//
+
+#ifndef _NF_HELPERS_H
+#define _NF_HELPERS_H
+
+//
+// Helper routines shared by nfflowlog.h, nfdns.h and nfstate.h
+//
+
+#ifndef _C_API
+namespace nfapi
+{
+#else
+#ifdef __cplusplus
+extern "C" 
+{
+#endif
+#endif
+
+	#define NF_HASH_INIT	2166136261UL
+
+	/**
+	*	Updates FNV-1a hash with the contents of buffer
+	*	@param hash Previous hash value or NF_HASH_INIT
+	*	@param buf Pointer to data buffer
+	*	@param len Buffer length
+	**/
+	__inline unsigned long nf_hashBytes(unsigned long hash, const void * buf, unsigned long len)
+	{
+		const unsigned char * p = (const unsigned char *)buf;
+		unsigned long i;
+
+		for (i = 0; i < len; i++)
+		{
+			hash = (hash ^ p[i]) * 16777619UL;
+		}
+
+		return hash;
+	}
+
+	/**
+	*	Returns current system time as FILETIME value
+	**/
+	__inline unsigned __int64 nf_getSystemTime()
+	{
+		FILETIME ft;
+		GetSystemTimeAsFileTime(&ft);
+		return ((unsigned __int64)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+	}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,634 @@
+//
+// 	NetFilterSDK
+// 	Copyright (C) 2009 Vitaly Sidorov
+//	All rights reserved.
+//
+//	This file is a part of the NetFilter SDK.
+//	The code and information is provided "as-is" without
+//	warranty of any kind, either expressed or implied.
+//
+
+#ifndef _NF_STATE_H
+#define _NF_STATE_H
+
+#include <tchar.h>
+#include "nfhelpers.h"
+
+#ifndef _C_API
+namespace nfapi
+{
+#else
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+#endif
+
+	#define NF_STATE_SIGNATURE		0x5453464e	// "NFST"
+	#define NF_STATE_VERSION		2
+	#define NF_STATE_MAX_PROBES		16
+
+	/**
+	*	Connection table entry states
+	**/
+	typedef enum _NF_STATE_ENTRY_STATE
+	{
+		NF_SES_EMPTY = 0,		// Never used
+		NF_SES_USED = 1,		// Contains valid data
+		NF_SES_DELETED = 2,		// Removed entry
+		NF_SES_WRITING = 3		// Update in progress, ignored after a crash
+	} NF_STATE_ENTRY_STATE;
+
+	#pragma pack(push, 8)
+
+	/**
+	*	State file header. The sections follow it in order:
+	*	rules, verdict cache, connection table.
+	**/
+	typedef struct _NF_STATE_HEADER
+	{
+		unsigned long	signature;		// NF_STATE_SIGNATURE
+		unsigned long	version;		// NF_STATE_VERSION
+		unsigned long	headerSize;		// sizeof(NF_STATE_HEADER)
+		unsigned long	ruleSize;		// sizeof(NF_RULE_EX)
+		unsigned long	ruleCapacity;	// Maximum number of rules
+		unsigned long	verdictCapacity; // Number of verdict cache entries
+		unsigned long	connCapacity;	// Number of connection table entries
+		unsigned long	connDataSize;	// Size of user data in connection entry
+		unsigned long	ruleCount;		// Number of stored rules
+		volatile LONG	rulesSequence;	// Odd while rules are being updated
+		unsigned long	rulesChecksum;	// Checksum of stored rules
+		unsigned long	cleanShutdown;	// Non-zero if the store was closed with nf_stateClose
+		unsigned __int64	sessionId;	// Session of the connection table entries
+		unsigned __int64	rulesOffset;
+		unsigned __int64	verdictOffset;
+		unsigned __int64	connOffset;
+		unsigned __int64	totalSize;
+	} NF_STATE_HEADER, *PNF_STATE_HEADER;
+
+	/**
+	*	Verdict cache entry. The check is seeded with the rules checksum,
+	*	so the entries stored for other rules are treated as misses.
+	**/
+	typedef struct _NF_STATE_VERDICT
+	{
+		unsigned __int64	key;		// User defined key
+		unsigned __int64	expires;	// FILETIME
+		unsigned long	verdict;		// User defined verdict, e.g. NF_FILTERING_FLAG
+		unsigned long	check;			// Checksum of the fields above
+	} NF_STATE_VERDICT, *PNF_STATE_VERDICT;
+
+	/**
+	*	Connection table entry, followed by connDataSize bytes of user data
+	**/
+	typedef struct _NF_STATE_CONN
+	{
+		ENDPOINT_ID		id;
+		volatile LONG	state;			// See NF_STATE_ENTRY_STATE
+		unsigned long	check;			// Checksum of id and data
+		unsigned __int64	updated;	// FILETIME of the last update
+	} NF_STATE_CONN, *PNF_STATE_CONN;
+
+	#pragma pack(pop)
+
+	/**
+	*	State store capacities
+	**/
+	typedef struct _NF_STATE_OPTIONS
+	{
+		unsigned long	ruleCapacity;	// Maximum number of rules
+		unsigned long	verdictCapacity; // Number of verdict cache entries
+		unsigned long	connCapacity;	// Number of connection table entries
+		unsigned long	connDataSize;	// Size of user data stored per connection
+		// Identifier of the session in which ENDPOINT_IDs are unique, e.g. the
+		// value of nf_getDriverInstanceId. Must be non-zero. The connection
+		// entries of other sessions are dropped when the store is opened.
+		unsigned __int64	sessionId;
+	} NF_STATE_OPTIONS, *PNF_STATE_OPTIONS;
+
+	typedef struct _NF_STATE
+	{
+		HANDLE			hFile;
+		HANDLE			hMapping;
+		PNF_STATE_HEADER	pHeader;
+		PNF_RULE_EX		pRules;
+		PNF_STATE_VERDICT	pVerdicts;
+		unsigned char *	pConns;
+		unsigned long	connEntrySize;
+		SRWLOCK			lock;		// Shared for lookups, exclusive for updates
+	} NF_STATE, *PNF_STATE;
+
+	__inline unsigned long nf_stateHash64(unsigned __int64 key)
+	{
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdULL;
+		key ^= key >> 33;
+		return (unsigned long)key;
+	}
+
+	__inline BOOL nf_stateValidate(PNF_STATE_HEADER pHeader, const NF_STATE_HEADER * pLayout)
+	{
+		if (pHeader->signature != NF_STATE_SIGNATURE ||
+			pHeader->version != NF_STATE_VERSION ||
+			pHeader->headerSize != pLayout->headerSize ||
+			pHeader->ruleSize != pLayout->ruleSize ||
+			pHeader->ruleCapacity != pLayout->ruleCapacity ||
+			pHeader->verdictCapacity != pLayout->verdictCapacity ||
+			pHeader->connCapacity != pLayout->connCapacity ||
+			pHeader->connDataSize != pLayout->connDataSize ||
+			pHeader->totalSize != pLayout->totalSize)
+		{
+			return FALSE;
+		}
+
+		if ((pHeader->rulesSequence & 1) || pHeader->ruleCount > pHeader->ruleCapacity)
+		{
+			return FALSE;
+		}
+
+		return TRUE;
+	}
+
+	/**
+	* Flushes the state to disk. The mapped data survives a crash of
+	* the process without it, flushing protects it from system failures.
+	* @param pState State store returned by nf_stateOpen
+	**/
+	__inline BOOL nf_stateFlush(PNF_STATE pState)
+	{
+		if (!FlushViewOfFile(pState->pHeader, 0))
+			return FALSE;
+
+		return FlushFileBuffers(pState->hFile);
+	}
+
+	/**
+	* Marks the store as cleanly closed, unmaps and closes the state file.
+	* @param pState State store returned by nf_stateOpen
+	**/
+	__inline void nf_stateClose(PNF_STATE pState)
+	{
+		if (!pState)
+			return;
+
+		if (pState->pHeader)
+		{
+			pState->pHeader->cleanShutdown = 1;
+			FlushViewOfFile(pState->pHeader, 0);
+			UnmapViewOfFile(pState->pHeader);
+		}
+
+		if (pState->hMapping)
+			CloseHandle(pState->hMapping);
+
+		if (pState->hFile != INVALID_HANDLE_VALUE)
+			CloseHandle(pState->hFile);
+
+
+		free(pState);
+	}
+
+	/**
+	* Opens or creates the state file and maps it to memory.
+	* The existing state is reused if its layout matches the options and
+	* the rules section is consistent, otherwise the store is reset.
+	* Cache and connection entries are validated individually on access.
+	* The connection table is cleared when the session differs from the
+	* session of the stored entries, see NF_STATE_OPTIONS.sessionId.
+	* @param fileName Path to the state file
+	* @param pOptions Store parameters, sessionId is required
+	* @param pRestored Receives TRUE if the previous state is reused
+	* @param pCleanShutdown Receives TRUE if the previous state was closed 
+	*	with nf_stateClose, FALSE after a crash or for a new store
+	* @return State store or NULL on error
+	**/
+	__inline PNF_STATE nf_stateOpen(const TCHAR * fileName, const NF_STATE_OPTIONS * pOptions, BOOL * pRestored, BOOL * pCleanShutdown)
+	{
+		PNF_STATE pState;
+		NF_STATE_HEADER layout;
+		unsigned char * pBase;
+
+		if (pRestored)
+			*pRestored = FALSE;
+		if (pCleanShutdown)
+			*pCleanShutdown = FALSE;
+
+		// Without a session the stale connection entries cannot be detected
+		if (!pOptions->sessionId)
+			return NULL;
+
+		pState = (PNF_STATE)calloc(1, sizeof(NF_STATE));
+		if (!pState)
+			return NULL;
+
+		InitializeSRWLock(&pState->lock);
+		pState->hFile = INVALID_HANDLE_VALUE;
+
+		// Entries are kept 8-byte aligned
+		pState->connEntrySize = (sizeof(NF_STATE_CONN) + pOptions->connDataSize + 7) & ~7UL;
+
+		memset(&layout, 0, sizeof(layout));
+		layout.signature = NF_STATE_SIGNATURE;
+		layout.version = NF_STATE_VERSION;
+		layout.headerSize = sizeof(NF_STATE_HEADER);
+		layout.ruleSize = sizeof(NF_RULE_EX);
+		layout.ruleCapacity = pOptions->ruleCapacity;
+		layout.verdictCapacity = pOptions->verdictCapacity;
+		layout.connCapacity = pOptions->connCapacity;
+		layout.connDataSize = pOptions->connDataSize;
+		layout.rulesOffset = sizeof(NF_STATE_HEADER);
+		layout.verdictOffset = (layout.rulesOffset +
+			(unsigned __int64)pOptions->ruleCapacity * sizeof(NF_RULE_EX) + 7) & ~7ULL;
+		layout.connOffset = layout.verdictOffset +
+			(unsigned __int64)pOptions->verdictCapacity * sizeof(NF_STATE_VERDICT);
+		layout.totalSize = layout.connOffset +
+			(unsigned __int64)pOptions->connCapacity * pState->connEntrySize;
+
+		pState->hFile = CreateFile(fileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+							OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (pState->hFile == INVALID_HANDLE_VALUE)
+		{
+			nf_stateClose(pState);
+			return NULL;
+		}
+
+		pState->hMapping = CreateFileMapping(pState->hFile, NULL, PAGE_READWRITE,
+							(DWORD)(layout.totalSize >> 32), (DWORD)layout.totalSize, NULL);
+		if (!pState->hMapping)
+		{
+			nf_stateClose(pState);
+			return NULL;
+		}
+
+		pBase = (unsigned char *)MapViewOfFile(pState->hMapping, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)layout.totalSize);
+		if (!pBase)
+		{
+			nf_stateClose(pState);
+			return NULL;
+		}
+
+		pState->pHeader = (PNF_STATE_HEADER)pBase;
+		pState->pRules = (PNF_RULE_EX)(pBase + layout.rulesOffset);
+		pState->pVerdicts = (PNF_STATE_VERDICT)(pBase + layout.verdictOffset);
+		pState->pConns = pBase + layout.connOffset;
+
+		if (nf_stateValidate(pState->pHeader, &layout) &&
+			nf_hashBytes(NF_HASH_INIT, pState->pRules,
+				pState->pHeader->ruleCount * sizeof(NF_RULE_EX)) == pState->pHeader->rulesChecksum)
+		{
+			if (pRestored)
+				*pRestored = TRUE;
+			if (pCleanShutdown)
+				*pCleanShutdown = pState->pHeader->cleanShutdown != 0;
+		} else
+		{
+			memset(pBase, 0, (size_t)layout.totalSize);
+			layout.rulesChecksum = nf_hashBytes(NF_HASH_INIT, NULL, 0);
+			*pState->pHeader = layout;
+		}
+
+		// ENDPOINT_IDs of other sessions may be reused by new connections
+		if (pState->pHeader->sessionId != pOptions->sessionId)
+		{
+			memset(pState->pConns, 0, (size_t)(layout.totalSize - layout.connOffset));
+		}
+		pState->pHeader->sessionId = pOptions->sessionId;
+
+		pState->pHeader->cleanShutdown = 0;
+
+		return pState;
+	}
+
+	/**
+	* Replaces the stored rules. The event masks are stored with the rules
+	* and restored by nf_stateApplyRules.
+	* @param pState State store returned by nf_stateOpen
+	* @param pRules Array of rules
+	* @param count Number of rules
+	**/
+	__inline BOOL nf_stateSetRules(PNF_STATE pState, const NF_RULE_EX * pRules, unsigned long count)
+	{
+		PNF_STATE_HEADER pHeader = pState->pHeader;
+
+		if (count > pHeader->ruleCapacity)
+			return FALSE;
+
+		AcquireSRWLockExclusive(&pState->lock);
+
+		// The odd sequence marks the section as inconsistent until the update completes
+		InterlockedIncrement(&pHeader->rulesSequence);
+		memcpy(pState->pRules, pRules, count * sizeof(NF_RULE_EX));
+		pHeader->ruleCount = count;
+		pHeader->rulesChecksum = nf_hashBytes(NF_HASH_INIT, pRules, count * sizeof(NF_RULE_EX));
+		InterlockedIncrement(&pHeader->rulesSequence);
+
+		ReleaseSRWLockExclusive(&pState->lock);
+
+		return TRUE;
+	}
+
+	/**
+	* Copies the stored rules
+	* @param pState State store returned by nf_stateOpen
+	* @param pRules Buffer for rules
+	* @param maxCount Buffer capacity in rules
+	* @return Number of stored rules, may be greater than maxCount
+	**/
+	__inline unsigned long nf_stateGetRules(PNF_STATE pState, PNF_RULE_EX pRules, unsigned long maxCount)
+	{
+		unsigned long count;
+
+		AcquireSRWLockShared(&pState->lock);
+
+		count = pState->pHeader->ruleCount;
+		memcpy(pRules, pState->pRules, ((count < maxCount)? count : maxCount) * sizeof(NF_RULE_EX));
+
+		ReleaseSRWLockShared(&pState->lock);
+
+		return count;
+	}
+
+	/**
+	* Replaces the driver rules with the stored rules. The event masks
+	* are ignored by drivers older than version 2, see nf_getDriverVersion.
+	* @param pState State store returned by nf_stateOpen
+	**/
+	__inline NF_STATUS nf_stateApplyRules(PNF_STATE pState)
+	{
+		NF_STATUS status;
+		BOOL hasRuleEx = nf_getDriverVersion() >= 2;
+		unsigned long i;
+
+		AcquireSRWLockShared(&pState->lock);
+
+		status = nf_deleteRules();
+
+		for (i = 0; i < pState->pHeader->ruleCount && status == NF_STATUS_SUCCESS; i++)
+		{
+			if (hasRuleEx)
+			{
+				status = nf_addRuleEx(&pState->pRules[i], FALSE);
+			} else
+			{
+				status = nf_addRule(&pState->pRules[i].rule, FALSE);
+			}
+		}
+
+		ReleaseSRWLockShared(&pState->lock);
+
+		return status;
+	}
+
+	__inline unsigned long nf_stateVerdictCheck(PNF_STATE pState, const NF_STATE_VERDICT * pEntry)
+	{
+		unsigned long hash;
+		hash = nf_hashBytes(NF_HASH_INIT, &pState->pHeader->rulesChecksum, sizeof(pState->pHeader->rulesChecksum));
+		hash = nf_hashBytes(hash, &pEntry->key, sizeof(pEntry->key));
+		hash = nf_hashBytes(hash, &pEntry->expires, sizeof(pEntry->expires));
+		hash = nf_hashBytes(hash, &pEntry->verdict, sizeof(pEntry->verdict));
+		return hash | 1;
+	}
+
+	/**
+	* Stores a verdict in the persistent cache. The verdict is valid
+	* until the stored rules are changed with nf_stateSetRules.
+	* @param pState State store returned by nf_stateOpen
+	* @param key User defined key, e.g. a hash of process and remote address
+	* @param verdict User defined verdict
+	* @param ttl Time to live in seconds
+	**/
+	__inline void nf_stateSetVerdict(PNF_STATE pState, unsigned __int64 key, unsigned long verdict, unsigned long ttl)
+	{
+		unsigned long n = pState->pHeader->verdictCapacity;
+		unsigned long hash = nf_stateHash64(key);
+		unsigned __int64 now = nf_getSystemTime();
+		PNF_STATE_VERDICT pEntry, pVictim = NULL;
+		unsigned long i;
+
+		if (n == 0)
+			return;
+
+		AcquireSRWLockExclusive(&pState->lock);
+
+		for (i = 0; i < NF_STATE_MAX_PROBES && i < n; i++)
+		{
+			pEntry = &pState->pVerdicts[(hash + i) % n];
+
+			if (pEntry->check == nf_stateVerdictCheck(pState, pEntry))
+			{
+				if (pEntry->key == key)
+				{
+					pVictim = pEntry;
+					break;
+				}
+				if (!pVictim && pEntry->expires <= now)
+					pVictim = pEntry;
+			} else
+			if (!pVictim)
+			{
+				// Empty or torn entry
+				pVictim = pEntry;
+			}
+		}
+
+		if (!pVictim)
+			pVictim = &pState->pVerdicts[hash % n];
+
+		pVictim->check = 0;
+		pVictim->key = key;
+		pVictim->expires = now + (unsigned __int64)ttl * 10000000;
+		pVictim->verdict = verdict;
+		pVictim->check = nf_stateVerdictCheck(pState, pVictim);
+
+		ReleaseSRWLockExclusive(&pState->lock);
+	}
+
+	/**
+	* Looks up a verdict in the persistent cache
+	* @param pState State store returned by nf_stateOpen
+	* @param key User defined key
+	* @param pVerdict Receives the verdict
+	* @return TRUE if a valid unexpired verdict is found
+	**/
+	__inline BOOL nf_stateGetVerdict(PNF_STATE pState, unsigned __int64 key, unsigned long * pVerdict)
+	{
+		unsigned long n = pState->pHeader->verdictCapacity;
+		unsigned long hash = nf_stateHash64(key);
+		PNF_STATE_VERDICT pEntry;
+		BOOL res = FALSE;
+		unsigned long i;
+
+		if (n == 0)
+			return FALSE;
+
+		AcquireSRWLockShared(&pState->lock);
+
+		for (i = 0; i < NF_STATE_MAX_PROBES && i < n; i++)
+		{
+			pEntry = &pState->pVerdicts[(hash + i) % n];
+
+			if (pEntry->key == key && pEntry->check == nf_stateVerdictCheck(pState, pEntry))
+			{
+				if (pEntry->expires > nf_getSystemTime())
+				{
+					*pVerdict = pEntry->verdict;
+					res = TRUE;
+				}
+				break;
+			}
+		}
+
+		ReleaseSRWLockShared(&pState->lock);
+
+		return res;
+	}
+
+	__inline PNF_STATE_CONN nf_stateConnEntry(PNF_STATE pState, unsigned long index)
+	{
+		return (PNF_STATE_CONN)(pState->pConns + (size_t)index * pState->connEntrySize);
+	}
+
+	__inline unsigned long nf_stateConnCheck(PNF_STATE pState, PNF_STATE_CONN pEntry)
+	{
+		unsigned long hash = nf_hashBytes(NF_HASH_INIT, &pEntry->id, sizeof(pEntry->id));
+		return nf_hashBytes(hash, pEntry + 1, pState->pHeader->connDataSize);
+	}
+
+	__inline PNF_STATE_CONN nf_stateConnFind(PNF_STATE pState, ENDPOINT_ID id, PNF_STATE_CONN * ppFree)
+	{
+		unsigned long n = pState->pHeader->connCapacity;
+		unsigned long hash = nf_stateHash64(id);
+		PNF_STATE_CONN pEntry;
+		unsigned long i;
+
+		if (ppFree)
+			*ppFree = NULL;
+
+		for (i = 0; i < NF_STATE_MAX_PROBES && i < n; i++)
+		{
+			pEntry = nf_stateConnEntry(pState, (hash + i) % n);
+
+			if (pEntry->state == NF_SES_USED)
+			{
+				if (pEntry->id == id)
+					return pEntry;
+				continue;
+			}
+
+			if (ppFree && !*ppFree)
+				*ppFree = pEntry;
+
+			if (pEntry->state == NF_SES_EMPTY)
+				break;
+		}
+
+		return NULL;
+	}
+
+	/**
+	* Stores user data for a connection. Call nf_stateConnDelete from
+	* tcpClosed/udpClosed handlers to release the entry. When the probed
+	* entries are all in use, the least recently updated one is replaced,
+	* so entries of connections closed while the service was stopped
+	* do not fill the table.
+	* @param pState State store returned by nf_stateOpen
+	* @param id Endpoint identifier
+	* @param data User data, connDataSize bytes
+	* @return FALSE if the store has no connection table
+	**/
+	__inline BOOL nf_stateConnSet(PNF_STATE pState, ENDPOINT_ID id, const void * data)
+	{
+		unsigned long n = pState->pHeader->connCapacity;
+		unsigned long hash = nf_stateHash64(id);
+		PNF_STATE_CONN pEntry, pFree, pOldest;
+		unsigned long i;
+
+		if (n == 0)
+			return FALSE;
+
+		AcquireSRWLockExclusive(&pState->lock);
+
+		pEntry = nf_stateConnFind(pState, id, &pFree);
+		if (!pEntry)
+			pEntry = pFree;
+
+		if (!pEntry)
+		{
+			pEntry = nf_stateConnEntry(pState, hash % n);
+			for (i = 1; i < NF_STATE_MAX_PROBES && i < n; i++)
+			{
+				pOldest = nf_stateConnEntry(pState, (hash + i) % n);
+				if (pOldest->updated < pEntry->updated)
+					pEntry = pOldest;
+			}
+		}
+
+		InterlockedExchange(&pEntry->state, NF_SES_WRITING);
+		pEntry->id = id;
+		pEntry->updated = nf_getSystemTime();
+		memcpy(pEntry + 1, data, pState->pHeader->connDataSize);
+		pEntry->check = nf_stateConnCheck(pState, pEntry);
+		InterlockedExchange(&pEntry->state, NF_SES_USED);
+
+		ReleaseSRWLockExclusive(&pState->lock);
+
+		return TRUE;
+	}
+
+	/**
+	* Returns user data stored for a connection
+	* @param pState State store returned by nf_stateOpen
+	* @param id Endpoint identifier
+	* @param data Buffer for connDataSize bytes
+	* @return TRUE if valid data is found
+	**/
+	__inline BOOL nf_stateConnGet(PNF_STATE pState, ENDPOINT_ID id, void * data)
+	{
+		PNF_STATE_CONN pEntry;
+		BOOL res = FALSE;
+
+		if (pState->pHeader->connCapacity == 0)
+			return FALSE;
+
+		AcquireSRWLockShared(&pState->lock);
+
+		pEntry = nf_stateConnFind(pState, id, NULL);
+		if (pEntry && pEntry->check == nf_stateConnCheck(pState, pEntry))
+		{
+			memcpy(data, pEntry + 1, pState->pHeader->connDataSize);
+			res = TRUE;
+		}
+
+		ReleaseSRWLockShared(&pState->lock);
+
+		return res;
+	}
+
+	/**
+	* Removes the connection entry
+	* @param pState State store returned by nf_stateOpen
+	* @param id Endpoint identifier
+	**/
+	__inline void nf_stateConnDelete(PNF_STATE pState, ENDPOINT_ID id)
+	{
+		PNF_STATE_CONN pEntry;
+
+		if (pState->pHeader->connCapacity == 0)
+			return;
+
+		AcquireSRWLockExclusive(&pState->lock);
+
+		pEntry = nf_stateConnFind(pState, id, NULL);
+		if (pEntry)
+		{
+			InterlockedExchange(&pEntry->state, NF_SES_DELETED);
+		}
+
+		ReleaseSRWLockExclusive(&pState->lock);
+	}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,219 @@
+//
+// 	NetFilterSDK
+// 	Copyright (C) 2009 Vitaly Sidorov
+//	All rights reserved.
+//
+//	This file is a part of the NetFilter SDK.
+//	The code and information is provided "as-is" without
+//	warranty of any kind, either expressed or implied.
+//
+
+//
+// Checks of the DNS response matching in nfdns.h, a mutation fuzz run of
+// nf_dnsParseResponse and a parser throughput benchmark.
+//
+// Built with the POSIX stubs of Win32 API in tests/stub, which also allow
+// moving the GetTickCount clock forward:
+//   g++ -O2 -fsanitize=address,undefined -D_NFAPI_STATIC_LIB
+//       -Itests/stub -I. tests/dnsparse_test.cpp -o dnsparse_test -lpthread
+//
+// Usage: dnsparse_test [fuzz iterations] [benchmark iterations]
+//
+
+#include <windows.h>
+#include <chrono>
+#include <random>
+#include "nfapi.h"
+#include "nfdns.h"
+
+using namespace nfapi;
+
+// The host rules are indicated to nf_addRule when no callback is set
+static int g_addedRules = 0;
+
+namespace nfapi
+{
+	NF_STATUS NFAPI_CC nf_addRule(PNF_RULE pRule, int toHead)
+	{
+		(void)pRule; (void)toHead;
+		g_addedRules++;
+		return NF_STATUS_SUCCESS;
+	}
+}
+
+static int g_failures = 0;
+
+#define CHECK(expr) \
+	do { if (!(expr)) { printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #expr); g_failures++; } } while (0)
+
+// Query for www.example.com, ID 0x1234
+static const unsigned char g_query[] = {
+	0x12, 0x34, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0,
+	3, 'w', 'w', 'w', 7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0, 0, 1, 0, 1
+};
+
+// Response: the A record of cdn.example.com precedes the CNAME leading to it,
+// the A record of "evil" is not reachable from the query name
+static const unsigned char g_response[] = {
+	0x12, 0x34, 0x81, 0x80, 0, 1, 0, 3, 0, 0, 0, 0,
+	3, 'W', 'w', 'W', 7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0, 0, 1, 0, 1,
+	3, 'c', 'd', 'n', 0xc0, 16, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4, 1, 2, 3, 4,
+	0xc0, 12, 0, 5, 0, 1, 0, 0, 0, 60, 0, 6, 3, 'c', 'd', 'n', 0xc0, 16,
+	4, 'e', 'v', 'i', 'l', 0, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4, 6, 6, 6, 6
+};
+
+static void makeSockaddr(unsigned char * sa, unsigned char a, unsigned char b,
+	unsigned char c, unsigned char d, unsigned short port)
+{
+	memset(sa, 0, NF_MAX_ADDRESS_LENGTH);
+	sa[0] = (unsigned char)AF_INET;
+	sa[2] = (unsigned char)(port >> 8);
+	sa[3] = (unsigned char)port;
+	sa[4] = a; sa[5] = b; sa[6] = c; sa[7] = d;
+}
+
+static void testMatching()
+{
+	unsigned char server[NF_MAX_ADDRESS_LENGTH], otherServer[NF_MAX_ADDRESS_LENGTH];
+	unsigned char target[NF_MAX_ADDRESS_LENGTH], evil[NF_MAX_ADDRESS_LENGTH];
+	PNF_DNS_CACHE pCache;
+	NF_RULE rule, matched;
+	char name[NF_DNS_MAX_NAME_LENGTH];
+	int i;
+
+	makeSockaddr(server, 8, 8, 8, 8, 53);
+	makeSockaddr(otherServer, 9, 9, 9, 9, 53);
+	makeSockaddr(target, 1, 2, 3, 4, 443);
+	makeSockaddr(evil, 6, 6, 6, 6, 443);
+
+	pCache = nf_dnsCacheCreate(1024);
+	CHECK(pCache != NULL);
+
+	memset(&rule, 0, sizeof(rule));
+	rule.filteringFlag = NF_BLOCK;
+	CHECK(nf_dnsCacheAddHostRule(pCache, "*.example.com", &rule));
+
+	// Response without query
+	nf_dnsCacheOnUdpReceive(pCache, 7, server, (const char*)g_response, sizeof(g_response));
+	CHECK(nf_dnsCacheLookup(pCache, AF_INET, target, name, sizeof(name), NULL) == 0);
+
+	// Response from other server
+	nf_dnsCacheOnUdpSend(pCache, 7, server, (const char*)g_query, sizeof(g_query));
+	nf_dnsCacheOnUdpReceive(pCache, 7, otherServer, (const char*)g_response, sizeof(g_response));
+	CHECK(nf_dnsCacheLookup(pCache, AF_INET, target, name, sizeof(name), NULL) == 0);
+
+	// Matching response, the address is cached under the query name
+	nf_dnsCacheOnUdpReceive(pCache, 7, server, (const char*)g_response, sizeof(g_response));
+	CHECK(nf_dnsCacheLookup(pCache, AF_INET, target, name, sizeof(name), &matched) == 2);
+	CHECK(strcmp(name, "www.example.com") == 0);
+	CHECK(matched.filteringFlag == NF_BLOCK);
+	CHECK(nf_dnsCacheLookup(pCache, AF_INET, evil, name, sizeof(name), NULL) == 0);
+	CHECK(g_addedRules == 1);
+
+	// Repeated resolutions extend the expanded rule instead of adding it again
+	for (i = 0; i < 100; i++)
+	{
+		g_stubTickAdjust += 31000;
+		nf_dnsCacheOnUdpSend(pCache, 7, server, (const char*)g_query, sizeof(g_query));
+		nf_dnsCacheOnUdpReceive(pCache, 7, server, (const char*)g_response, sizeof(g_response));
+		nf_dnsCacheOnUdpReceive(pCache, 7, server, (const char*)g_response, sizeof(g_response));
+	}
+	CHECK(g_addedRules == 1);
+
+	// Expired pairs are dropped and added again by the next resolution
+	g_stubTickAdjust += 120000;
+	CHECK(nf_dnsCacheExpireHostRules(pCache) == 1);
+	nf_dnsCacheApplyHostRules(pCache);
+	CHECK(g_addedRules == 1);
+	nf_dnsCacheOnUdpSend(pCache, 7, server, (const char*)g_query, sizeof(g_query));
+	nf_dnsCacheOnUdpReceive(pCache, 7, server, (const char*)g_response, sizeof(g_response));
+	CHECK(g_addedRules == 2);
+	nf_dnsCacheApplyHostRules(pCache);
+	CHECK(g_addedRules == 3);
+
+	nf_dnsCacheFree(pCache);
+}
+
+static void fuzzParser(unsigned long iterations)
+{
+	PNF_DNS_CACHE pCache = nf_dnsCacheCreate(4096);
+	std::mt19937 rng(12345);
+	unsigned char buf[sizeof(g_response)];
+	unsigned long i;
+	int pos, value, n, len;
+
+	// Every single byte value at every position
+	for (pos = 0; pos < (int)sizeof(g_response); pos++)
+	{
+		memcpy(buf, g_response, sizeof(g_response));
+		for (value = 0; value < 256; value++)
+		{
+			buf[pos] = (unsigned char)value;
+			nf_dnsParseResponse(pCache, (const char*)buf, sizeof(buf), "www.example.com");
+		}
+	}
+
+	// Every truncation
+	for (len = 0; len <= (int)sizeof(g_response); len++)
+	{
+		nf_dnsParseResponse(pCache, (const char*)g_response, len, "www.example.com");
+	}
+
+	// Random multi-byte mutations with random lengths
+	for (i = 0; i < iterations; i++)
+	{
+		memcpy(buf, g_response, sizeof(g_response));
+		for (n = 1 + rng() % 8; n > 0; n--)
+		{
+			buf[rng() % sizeof(buf)] = (unsigned char)rng();
+		}
+		nf_dnsParseResponse(pCache, (const char*)buf, (int)(rng() % (sizeof(buf) + 1)), "www.example.com");
+	}
+
+	nf_dnsCacheFree(pCache);
+
+	printf("fuzz: %lu random mutations, %d single byte mutations, no crashes\n",
+		iterations, (int)sizeof(g_response) * 256);
+}
+
+static void benchmarkParser(unsigned long iterations)
+{
+	PNF_DNS_CACHE pCache = nf_dnsCacheCreate(65536);
+	std::chrono::steady_clock::time_point t0, t1;
+	unsigned long i;
+	int total = 0;
+	double seconds;
+
+	t0 = std::chrono::steady_clock::now();
+	for (i = 0; i < iterations; i++)
+	{
+		total += nf_dnsParseResponse(pCache, (const char*)g_response, sizeof(g_response), "www.example.com");
+	}
+	t1 = std::chrono::steady_clock::now();
+
+	seconds = std::chrono::duration<double>(t1 - t0).count();
+	printf("parse: %lu responses in %.3f s, %.0f responses/s, %.1f MB/s (%d addresses)\n",
+		iterations, seconds, iterations / seconds,
+		iterations * sizeof(g_response) / seconds / (1024 * 1024), total);
+
+	nf_dnsCacheFree(pCache);
+}
+
+int main(int argc, char ** argv)
+{
+	unsigned long fuzzIterations = (argc > 1)? strtoul(argv[1], NULL, 10) : 1000000;
+	unsigned long benchIterations = (argc > 2)? strtoul(argv[2], NULL, 10) : 1000000;
+
+	testMatching();
+	fuzzParser(fuzzIterations);
+	benchmarkParser(benchIterations);
+
+	if (g_failures)
+	{
+		printf("%d checks failed\n", g_failures);
+		return 1;
+	}
+
+	printf("all checks passed\n");
+	return 0;
+}
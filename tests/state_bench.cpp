@@ -0,0 +1,182 @@
+//
+// 	NetFilterSDK
+// 	Copyright (C) 2009 Vitaly Sidorov
+//	All rights reserved.
+//
+//	This file is a part of the NetFilter SDK.
+//	The code and information is provided "as-is" without
+//	warranty of any kind, either expressed or implied.
+//
+
+//
+// Measures the restart path of nfstate.h: a store with 10000 rules and
+// 100000 verdicts is filled, closed and opened again, then the rules are
+// reapplied and the verdicts are looked up from several threads.
+//
+// Built on Linux with the POSIX stubs of Win32 API in tests/stub:
+//   g++ -O2 -D_NFAPI_STATIC_LIB -Itests/stub -I. tests/state_bench.cpp
+//       -o state_bench -lpthread
+//
+// Usage: state_bench [state file] [lookup threads]
+//
+
+#include <windows.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "nfapi.h"
+#include "nfstate.h"
+
+using namespace nfapi;
+
+#define RULE_COUNT		10000
+#define VERDICT_COUNT	100000
+#define CONN_COUNT		10000
+#define LOOKUP_ROUNDS	10
+
+// Driver calls made by nf_stateApplyRules
+static unsigned long g_appliedRules = 0;
+
+namespace nfapi
+{
+	NF_STATUS NFAPI_CC nf_deleteRules()
+	{
+		g_appliedRules = 0;
+		return NF_STATUS_SUCCESS;
+	}
+
+	NF_STATUS NFAPI_CC nf_addRule(PNF_RULE pRule, int toHead)
+	{
+		(void)pRule; (void)toHead;
+		g_appliedRules++;
+		return NF_STATUS_SUCCESS;
+	}
+
+	NF_STATUS NFAPI_CC nf_addRuleEx(PNF_RULE_EX pRule, int toHead)
+	{
+		(void)pRule; (void)toHead;
+		g_appliedRules++;
+		return NF_STATUS_SUCCESS;
+	}
+
+	unsigned long NFAPI_CC nf_getDriverVersion()
+	{
+		return NF_DRIVER_VERSION;
+	}
+}
+
+static double msSince(std::chrono::steady_clock::time_point t0)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static unsigned __int64 verdictKey(unsigned long i)
+{
+	return (unsigned __int64)i * 7919 + 1;
+}
+
+int main(int argc, char ** argv)
+{
+	const char * fileName = (argc > 1)? argv[1] : "state_bench.nfs";
+	int threadCount = (argc > 2)? atoi(argv[2]) : 4;
+	std::chrono::steady_clock::time_point t0;
+	std::vector<NF_RULE_EX> rules(RULE_COUNT);
+	std::vector<std::thread> threads;
+	std::vector<unsigned long> hits(threadCount);
+	NF_STATE_OPTIONS options;
+	PNF_STATE pState;
+	BOOL restored, cleanShutdown;
+	char connData[32];
+	unsigned long i, totalHits = 0;
+	double openMs, applyMs, lookupMs;
+	int t;
+
+	memset(&options, 0, sizeof(options));
+	options.ruleCapacity = RULE_COUNT;
+	options.verdictCapacity = VERDICT_COUNT * 4 / 3;
+	options.connCapacity = CONN_COUNT * 2;
+	options.connDataSize = sizeof(connData);
+	options.sessionId = 1;
+
+	remove(fileName);
+
+	// First run fills the store
+	pState = nf_stateOpen(fileName, &options, &restored, &cleanShutdown);
+	if (!pState)
+	{
+		printf("cannot create %s\n", fileName);
+		return 1;
+	}
+
+	for (i = 0; i < RULE_COUNT; i++)
+	{
+		memset(&rules[i], 0, sizeof(NF_RULE_EX));
+		rules[i].rule.protocol = IPPROTO_TCP;
+		rules[i].rule.remotePort = (unsigned short)i;
+		rules[i].rule.filteringFlag = NF_FILTER;
+		rules[i].eventMask = NF_EM_TCP_CONNECTIONS;
+	}
+	nf_stateSetRules(pState, &rules[0], RULE_COUNT);
+
+	for (i = 0; i < VERDICT_COUNT; i++)
+	{
+		nf_stateSetVerdict(pState, verdictKey(i), i, 3600);
+	}
+
+	memset(connData, 0x5a, sizeof(connData));
+	for (i = 0; i < CONN_COUNT; i++)
+	{
+		nf_stateConnSet(pState, i + 1, connData);
+	}
+
+	nf_stateClose(pState);
+
+	// Restart
+	t0 = std::chrono::steady_clock::now();
+	pState = nf_stateOpen(fileName, &options, &restored, &cleanShutdown);
+	openMs = msSince(t0);
+	if (!pState || !restored)
+	{
+		printf("state is not restored\n");
+		return 1;
+	}
+
+	t0 = std::chrono::steady_clock::now();
+	nf_stateApplyRules(pState);
+	applyMs = msSince(t0);
+
+	t0 = std::chrono::steady_clock::now();
+	for (t = 0; t < threadCount; t++)
+	{
+		threads.push_back(std::thread([pState, t, &hits]()
+		{
+			unsigned long verdict, round, j;
+
+			for (round = 0; round < LOOKUP_ROUNDS; round++)
+			{
+				for (j = 0; j < VERDICT_COUNT; j++)
+				{
+					if (nf_stateGetVerdict(pState, verdictKey(j), &verdict) && verdict == j)
+						hits[t]++;
+				}
+			}
+		}));
+	}
+	for (t = 0; t < threadCount; t++)
+	{
+		threads[t].join();
+		totalHits += hits[t];
+	}
+	lookupMs = msSince(t0);
+
+	printf("reopen: %.3f ms, clean shutdown %d\n", openMs, cleanShutdown);
+	printf("apply: %lu rules in %.3f ms\n", g_appliedRules, applyMs);
+	printf("verdicts: %lu of %d found after restart\n", totalHits / threadCount / LOOKUP_ROUNDS, VERDICT_COUNT);
+	printf("lookup: %d threads, %.0f lookups/s\n", threadCount,
+		(double)threadCount * LOOKUP_ROUNDS * VERDICT_COUNT / (lookupMs / 1000));
+
+	nf_stateClose(pState);
+	remove(fileName);
+
+	return 0;
+}
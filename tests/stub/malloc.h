@@ -0,0 +1,2 @@
+// malloc.h is provided by windows.h of the test stubs
+#include <windows.h>
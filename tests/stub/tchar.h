@@ -0,0 +1,2 @@
+// tchar.h is provided by windows.h of the test stubs
+#include <windows.h>
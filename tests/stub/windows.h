@@ -0,0 +1,252 @@
+//
+// 	NetFilterSDK 
+// 	Copyright (C) 2009 Vitaly Sidorov
+//	All rights reserved.
+//
+//	This file is a part of the NetFilter SDK.
+//	The code and information is provided "as-is" without
+//	warranty of any kind, either expressed or implied.
+//
+
+//
+// Minimal POSIX implementation of the Win32 API used by the SDK utility
+// headers nfdns.h and nfstate.h. It allows building the programs in tests
+// with g++ on Linux, on Windows they are built with the real headers.
+//
+
+#ifndef _NF_TEST_WINDOWS_H
+#define _NF_TEST_WINDOWS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#define __int64 long long
+#define UNALIGNED
+#define WINAPI
+#define __declspec(x)
+
+#define TRUE	1
+#define FALSE	0
+#define MAX_PATH	260
+#define INFINITE	0xffffffff
+
+typedef int BOOL;
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef unsigned int DWORD;
+typedef int LONG;
+typedef char TCHAR;
+typedef size_t SIZE_T;
+typedef void * HANDLE;
+typedef void * LPVOID;
+
+#define _T(x) x
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+
+#define GENERIC_READ	0x80000000
+#define GENERIC_WRITE	0x40000000
+#define FILE_SHARE_READ	1
+#define CREATE_NEW		1
+#define CREATE_ALWAYS	2
+#define OPEN_ALWAYS		4
+#define FILE_ATTRIBUTE_NORMAL	0x80
+#define PAGE_READWRITE	4
+#define FILE_MAP_ALL_ACCESS	0xf001f
+
+typedef struct _FILETIME
+{
+	DWORD dwLowDateTime;
+	DWORD dwHighDateTime;
+} FILETIME;
+
+typedef struct _SRWLOCK
+{
+	pthread_rwlock_t lock;
+} SRWLOCK;
+
+//
+// Time
+//
+
+// Added to GetTickCount results, allows tests to move the clock forward
+static DWORD g_stubTickAdjust = 0;
+
+static inline DWORD GetTickCount()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (DWORD)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000) + g_stubTickAdjust;
+}
+
+static inline void GetSystemTimeAsFileTime(FILETIME * pft)
+{
+	struct timespec ts;
+	unsigned long long t;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	// 100-ns intervals since January 1, 1601
+	t = (unsigned long long)ts.tv_sec * 10000000 + ts.tv_nsec / 100 + 116444736000000000ULL;
+	pft->dwLowDateTime = (DWORD)t;
+	pft->dwHighDateTime = (DWORD)(t >> 32);
+}
+
+//
+// Synchronization
+//
+
+static inline void InitializeSRWLock(SRWLOCK * p) { pthread_rwlock_init(&p->lock, NULL); }
+static inline void AcquireSRWLockShared(SRWLOCK * p) { pthread_rwlock_rdlock(&p->lock); }
+static inline void ReleaseSRWLockShared(SRWLOCK * p) { pthread_rwlock_unlock(&p->lock); }
+static inline void AcquireSRWLockExclusive(SRWLOCK * p) { pthread_rwlock_wrlock(&p->lock); }
+static inline void ReleaseSRWLockExclusive(SRWLOCK * p) { pthread_rwlock_unlock(&p->lock); }
+
+static inline LONG InterlockedIncrement(volatile LONG * p) { return __sync_add_and_fetch(p, 1); }
+static inline LONG InterlockedExchange(volatile LONG * p, LONG v) { return __sync_lock_test_and_set(p, v); }
+
+//
+// Files and mappings. File and mapping handles carry the descriptor,
+// the sizes of mapped views are kept for unmapping.
+//
+
+typedef struct _STUB_HANDLE
+{
+	int		fd;
+	size_t	size;
+} STUB_HANDLE;
+
+#define STUB_MAX_VIEWS	64
+
+static struct
+{
+	void *	p;
+	size_t	size;
+} g_stubViews[STUB_MAX_VIEWS];
+
+static inline HANDLE CreateFile(const TCHAR * fileName, DWORD access, DWORD share, void * security,
+	DWORD disposition, DWORD flags, HANDLE hTemplate)
+{
+	STUB_HANDLE * h;
+	int oflags = O_RDWR | O_CREAT;
+	int fd;
+
+	(void)access; (void)share; (void)security; (void)flags; (void)hTemplate;
+
+	if (disposition == CREATE_NEW)
+		oflags |= O_EXCL;
+	else if (disposition == CREATE_ALWAYS)
+		oflags |= O_TRUNC;
+
+	fd = open(fileName, oflags, 0644);
+	if (fd < 0)
+		return INVALID_HANDLE_VALUE;
+
+	h = (STUB_HANDLE*)calloc(1, sizeof(STUB_HANDLE));
+	h->fd = fd;
+	return h;
+}
+
+static inline HANDLE CreateFileMapping(HANDLE hFile, void * security, DWORD protect,
+	DWORD sizeHigh, DWORD sizeLow, const TCHAR * name)
+{
+	STUB_HANDLE * pFile = (STUB_HANDLE*)hFile;
+	STUB_HANDLE * h;
+	size_t size = ((size_t)sizeHigh << 32) | sizeLow;
+	struct stat st;
+
+	(void)security; (void)protect; (void)name;
+
+	// The file grows to the mapping size
+	if (fstat(pFile->fd, &st) != 0)
+		return NULL;
+	if ((size_t)st.st_size < size && ftruncate(pFile->fd, (off_t)size) != 0)
+		return NULL;
+
+	h = (STUB_HANDLE*)calloc(1, sizeof(STUB_HANDLE));
+	h->fd = dup(pFile->fd);
+	h->size = size;
+	return h;
+}
+
+static inline void * MapViewOfFile(HANDLE hMapping, DWORD access, DWORD offsetHigh, DWORD offsetLow, SIZE_T size)
+{
+	STUB_HANDLE * pMapping = (STUB_HANDLE*)hMapping;
+	void * p;
+	int i;
+
+	(void)access; (void)offsetHigh; (void)offsetLow;
+
+	if (!size)
+		size = pMapping->size;
+
+	for (i = 0; i < STUB_MAX_VIEWS; i++)
+	{
+		if (!g_stubViews[i].p)
+			break;
+	}
+	if (i == STUB_MAX_VIEWS)
+		return NULL;
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, pMapping->fd, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	g_stubViews[i].p = p;
+	g_stubViews[i].size = size;
+	return p;
+}
+
+static inline size_t StubViewSize(const void * p)
+{
+	int i;
+
+	for (i = 0; i < STUB_MAX_VIEWS; i++)
+	{
+		if (g_stubViews[i].p == p)
+			return g_stubViews[i].size;
+	}
+	return 0;
+}
+
+static inline BOOL FlushViewOfFile(const void * p, SIZE_T size)
+{
+	return msync((void*)p, size? size : StubViewSize(p), MS_SYNC) == 0;
+}
+
+static inline BOOL UnmapViewOfFile(const void * p)
+{
+	int i;
+
+	for (i = 0; i < STUB_MAX_VIEWS; i++)
+	{
+		if (g_stubViews[i].p == p)
+		{
+			g_stubViews[i].p = NULL;
+			return munmap((void*)p, g_stubViews[i].size) == 0;
+		}
+	}
+	return FALSE;
+}
+
+static inline BOOL FlushFileBuffers(HANDLE hFile)
+{
+	return fsync(((STUB_HANDLE*)hFile)->fd) == 0;
+}
+
+static inline BOOL CloseHandle(HANDLE h)
+{
+	int res = close(((STUB_HANDLE*)h)->fd);
+	free(h);
+	return res == 0;
+}
+
+#endif